@@ -13,10 +13,20 @@
 #include <cassert>      // For assert
 #include <new>          // For placement new
 #include <string>
+#include <vector>
+#include <unordered_map>
 #include <span>
 #include <optional>
 #include <memory>
 #include <stdexcept>    // For std::runtime_error
+#include <bit>
+#include <algorithm>
+#include <type_traits>
+
+// Use SSE2 to check characters in bounded input, unless disabled
+#if defined(__SSE2__) && !defined(FLXML_NO_SIMD)
+    #include <emmintrin.h>
+#endif
 
 // On MSVC, disable "conditional expression is constant" warning (level 4).
 // This warning is almost impossible to avoid with certain types of templated code
@@ -149,6 +159,32 @@ namespace flxml
     #define FLXML_DYNAMIC_POOL_SIZE (64 * 1024)
 #endif
 
+///////////////////////////////////////////////////////////////////////////
+// Validation
+
+#ifndef FLXML_ATTRIBUTE_HASH_THRESHOLD
+    // Number of attributes above which xml_node::validate() stops comparing attributes pairwise,
+    // and uses a hash set to find duplicates instead.
+    // Define FLXML_ATTRIBUTE_HASH_THRESHOLD before including flxml.h if you want to override the default value.
+    #define FLXML_ATTRIBUTE_HASH_THRESHOLD 16
+#endif
+
+#ifndef FLXML_MAX_DEPTH
+    // Maximum nesting depth of elements the parser accepts, counting the outermost as one.
+    // The parser keeps open elements on the heap rather than the stack, so this only bounds memory use on hostile input.
+    // Define FLXML_MAX_DEPTH before including flxml.h if you want to override the default value.
+    #define FLXML_MAX_DEPTH 4096
+#endif
+
+///////////////////////////////////////////////////////////////////////////
+// Lookup
+
+#ifndef FLXML_CHILD_INDEX_THRESHOLD
+    // Number of children a named lookup must scan past before the node builds an index of its children by name.
+    // Define FLXML_CHILD_INDEX_THRESHOLD before including flxml.h if you want to override the default value.
+    #define FLXML_CHILD_INDEX_THRESHOLD 32
+#endif
+
 namespace flxml
 {
     // Forward declarations
@@ -276,6 +312,17 @@ namespace flxml
     //! and duplicate attributes (with different prefices)
     const int parse_validate_xmlns = 0x4000;
 
+    //! Parse flag instructing the parser to check that text, attribute values, names, comments, CDATA and PIs
+    //! hold only characters matching XML's Char production, and that they are well-formed UTF-8
+    //! unless rapidxml::parse_no_utf8 is given. Control characters other than tab, CR and LF are rejected,
+    //! as are overlong UTF-8 forms, surrogates, U+FFFE and U+FFFF. Character references in text and attribute
+    //! values, such as &amp;#1;, are held to the same rule, whether or not they are later expanded.
+    //! The check is made as the text is scanned, rather than as a separate pass; bounded input,
+    //! such as a string_view, is checked 16 bytes at a time where SSE2 is available.
+    //! <br><br>
+    //! See xml_document::parse() function.
+    const int parse_validate_chars = 0x8000;
+
     // Compound flags
 
     //! Parse flags which represent default behaviour of the parser.
@@ -379,6 +426,7 @@ namespace flxml
         xml_node<Ch> * allocate_node_low(Args... args) {
             void *memory = allocate_aligned<xml_node<Ch>>();
             auto *node = new(memory) xml_node<Ch>(args...);
+            node->m_allocator = m_owner;
             return node;
         }
         xml_node<Ch> * allocate_node(node_type type, view_type const & name, view_type const & value) {
@@ -406,6 +454,7 @@ namespace flxml
         xml_attribute<Ch> *allocate_attribute_low(Args... args) {
             void *memory = allocate_aligned<xml_attribute<Ch>>();
             auto *attribute = new(memory) xml_attribute<Ch>(args...);
+            attribute->m_allocator = m_owner;
             return attribute;
         }
         xml_attribute<Ch> * allocate_attribute(view_type const & name, view_type const & value) {
@@ -437,6 +486,19 @@ namespace flxml
             return {result, source.size()};
         }
 
+        //! Allocates an array of value-initialized objects from the pool.
+        //! The objects will never be destroyed, so T should be trivially destructible.
+        //! \param n Number of objects to allocate.
+        //! \return Span covering the allocated objects.
+        template<typename T>
+        std::span<T> allocate_array(std::size_t n)
+        {
+            T *result = allocate_aligned<T>(n);
+            for (std::size_t i = 0; i != n; ++i)
+                new(result + i) T();
+            return {result, n};
+        }
+
         template<typename Sch>
         view_type allocate_string(std::basic_string_view<Sch> const & source) {
             auto span = allocate_span(source);
@@ -540,6 +602,9 @@ namespace flxml
             m_free_func = ff;
         }
 
+    protected:
+        xml_document<Ch> *m_owner = nullptr;                          // Document this pool belongs to, or 0 for a standalone pool
+
     private:
 
         struct header
@@ -631,6 +696,7 @@ namespace flxml
     template<typename Ch = char>
     class xml_base
     {
+        friend class memory_pool<Ch>;
 
     public:
         using view_type = std::basic_string_view<Ch>;
@@ -709,6 +775,24 @@ namespace flxml
             m_value = value;
         }
 
+        //! Gets the text this was parsed from, if it has not been modified since.
+        //! For a node, this covers the whole node including any descendants, and for an attribute, the name,
+        //! equals sign and quoted value. The printer copies this text instead of reconstructing it.
+        //! \return Source text, or empty if not parsed or modified since.
+        view_type const & source() const
+        {
+            return m_source;
+        }
+
+        //! Gets the whitespace which preceded this in the parsed text.
+        //! Two parsed siblings can be copied together when this whitespace starts where the first one ends.
+        //! Unlike source(), this is kept when modified, so the printer can reuse the original indentation.
+        //! \return Preceding whitespace, which has a null data() if not parsed.
+        view_type const & source_space() const
+        {
+            return m_source_space;
+        }
+
         ///////////////////////////////////////////////////////////////////////////
         // Related nodes access
 
@@ -723,6 +807,9 @@ namespace flxml
         view_type m_name;                         // Name of node, or 0 if no name
         view_type m_value;                        // Value of node, or 0 if no value
         xml_node<Ch> *m_parent = nullptr;             // Pointer to parent node, or 0 if none
+        xml_document<Ch> *m_allocator = nullptr;      // Document whose pool allocated this, or 0 if unknown
+        view_type m_source;                       // Parsed text, or empty if not parsed or modified since
+        view_type m_source_space;                 // Whitespace preceding this in the parsed text
     };
 
     //! Class representing attribute node of XML document.
@@ -735,6 +822,7 @@ namespace flxml
     {
 
         friend class xml_node<Ch>;
+        friend class xml_document<Ch>;
 
     public:
         using view_type = std::basic_string_view<Ch>;
@@ -749,8 +837,23 @@ namespace flxml
         xml_attribute(view_type const & name) : xml_base<Ch>(name) {}
         xml_attribute(view_type const & name, view_type const & value) : xml_base<Ch>(name, value) {}
 
+        using xml_base<Ch>::name;
+
+        //! Sets name of attribute.
+        //! See xml_base::name(); this also keeps the document's ID index current.
+        void name(view_type const & name) {
+            auto doc = document();
+            if (doc) doc->unindex_id(this);
+            xml_base<Ch>::name(name);
+            this->m_source = {};
+            if (this->m_parent) this->m_parent->dirty_start_tag();
+            if (doc) doc->index_id(this);
+        }
+
         void quote(Ch q) {
             m_quote = q;
+            this->m_source = {};
+            if (this->m_parent) this->m_parent->dirty_start_tag();
         }
         Ch quote() const {
             return m_quote;
@@ -758,13 +861,17 @@ namespace flxml
 
         view_type const & value() const {
             if (m_value.has_value()) return m_value.value();
-            m_value = document()->decode_attr_value(this);
+            m_value = allocator()->decode_attr_value(this);
             return m_value.value();
         }
         void value(view_type const & v) {
+            auto doc = document();
+            if (doc) doc->unindex_id(this);
             m_value = v;
             this->value_raw("");
-            if (this->m_parent) this->m_parent->dirty_parent();
+            this->m_source = {};
+            if (this->m_parent) this->m_parent->dirty_start_tag();
+            if (doc) doc->index_id(this);
         }
         // Return true if the value has been decoded.
         bool value_decoded() const {
@@ -785,6 +892,14 @@ namespace flxml
             }
         }
 
+        //! Gets the document which allocated the attribute, whether or not it is within that document's tree.
+        //! Attributes allocated from a standalone memory_pool have none, and use their parent's document.
+        //! \return Pointer to document, or 0 if there is none.
+        optional_ptr<xml_document<Ch>> allocator() const {
+            if (this->m_allocator) return this->m_allocator;
+            return document();
+        }
+
         view_type const & xmlns() const {
             if (m_xmlns.has_value()) return m_xmlns.value();
             auto const & name = this->name();
@@ -793,7 +908,7 @@ namespace flxml
                 auto element = this->parent();
                 if (element) m_xmlns = element->xmlns_lookup(name.substr(0, colon), true);
             } else {
-                m_xmlns = document()->nullstr();
+                m_xmlns = allocator()->nullstr();
             }
             return m_xmlns.value();
         }
@@ -869,6 +984,7 @@ namespace flxml
     template<typename Ch = char>
     class xml_node: public xml_base<Ch>
     {
+        friend class xml_document<Ch>;
     public:
         using view_type = std::basic_string_view<Ch>;
         using ptr = optional_ptr<xml_node<Ch>>;
@@ -888,10 +1004,21 @@ namespace flxml
 
         ///////////////////////////////////////////////////////////////////////////
         // Node data access
+        using xml_base<Ch>::name;
+
+        //! Sets name of node.
+        //! See xml_base::name(); this also keeps any name index held by the parent current.
+        void name(view_type const & name) {
+            if (this->m_parent) this->m_parent->index_remove(this);
+            xml_base<Ch>::name(name);
+            if (this->m_parent) this->m_parent->index_insert(this);
+            dirty_start_tag();
+        }
+
         view_type const & value() const {
             if (m_value.has_value()) return m_value.value();
             if (m_type == node_element || m_type == node_data) {
-                m_value = document()->decode_data_value(this);
+                m_value = allocator()->decode_data_value(this);
             } else {
                 m_value = this->value_raw();
             }
@@ -900,11 +1027,21 @@ namespace flxml
 
         void dirty() {
             m_clean = false;
+            this->m_source = {};
+            m_printed = {};
+            // Within a mutation_batch, ancestors are marked once when the batch ends.
+            if (this->m_document && this->m_document->defer_dirty(this)) return;
             dirty_parent();
         }
         void dirty_parent() {
             if (this->m_parent) this->m_parent->dirty();
         }
+        // The name or attributes have changed, but not the children.
+        void dirty_start_tag() {
+            this->m_source = {};
+            m_start_tag = {};
+            dirty_parent();
+        }
         bool clean() const {
             return m_clean;
         }
@@ -936,7 +1073,7 @@ namespace flxml
 
         void prefix(view_type const & prefix) {
             m_prefix = prefix;
-            dirty_parent();
+            dirty_start_tag();
         }
 
         view_type const & prefix() const {
@@ -953,6 +1090,44 @@ namespace flxml
             return m_contents;
         }
 
+        //! Gets the parsed start tag, from its < up to its last attribute (or its name, if none), while the name,
+        //! prefix and attributes are unmodified. Unlike source(), this survives changes to the children,
+        //! so the printer can still copy the start tag in one go.
+        //! \return Start tag text, or empty if not parsed or modified since.
+        view_type const & start_tag() const
+        {
+            return m_start_tag;
+        }
+
+        //! Enables or disables caching of this element's printed contents.
+        //! Once printed without indenting, the contents are kept in the document's pool and copied by later prints,
+        //! until a change to the element or any descendant discards them. A refill reuses the cache's memory when it fits,
+        //! and otherwise takes more from the pool, so this suits elements printed many times between changes.
+        //! \param enable True to cache the printed contents.
+        void print_cache(bool enable) {
+            m_print_cache = enable;
+            if (!enable) m_printed = {};
+        }
+        bool print_cache() const {
+            return m_print_cache;
+        }
+
+        //! Gets the cached printed contents, as printed without indenting.
+        //! \return Printed contents, or empty if not cached or changed since.
+        view_type const & printed() const {
+            return m_printed;
+        }
+        //! Sets the cached printed contents; the printer does this for elements with print_cache() enabled.
+        //! The contents are copied into the document's pool, into the memory of an earlier cache if they fit.
+        void printed(view_type const & printed) {
+            if (!m_print_cache) return;
+            if (printed.size() > m_print_storage.size())
+                m_print_storage = this->allocator()->allocate_span(printed);
+            else
+                std::copy(printed.begin(), printed.end(), m_print_storage.begin());
+            m_printed = {m_print_storage.data(), printed.size()};
+        }
+
         view_type const & xmlns() const {
             if (m_xmlns.has_value()) return m_xmlns.value();
             m_xmlns = xmlns_lookup(m_prefix, false);
@@ -966,11 +1141,11 @@ namespace flxml
                 // Check if the prefix begins "xml".
                 if (prefix.size() >= 3 && prefix.starts_with("xml")) {
                     if (prefix.size() == 3) {
-                        return this->document()->xmlns_xml();
+                        return this->allocator()->xmlns_xml();
                     } else if (prefix.size() == 5
                                && prefix[3] == Ch('n')
                                && prefix[4] == Ch('s')) {
-                        return this->document()->xmlns_xmlns();
+                        return this->allocator()->xmlns_xmlns();
                     }
                 }
                 attrname += ':';
@@ -991,24 +1166,27 @@ namespace flxml
                     throw element_xmlns_unbound(attrname.c_str());
                 }
             }
-            return document()->nullstr();
+            return allocator()->nullstr();
         }
 
         ///////////////////////////////////////////////////////////////////////////
         // Related nodes access
 
         //! Gets document of which node is a child.
+        //! This is kept as nodes are linked and unlinked, so it is found in constant time.
         //! \return Pointer to document that contains this node, or 0 if there is no parent document.
         optional_ptr<xml_document<Ch>> document() const
         {
-            auto *node = this;
-            while (node) {
-                if (node->type() == node_document) {
-                    return static_cast<xml_document<Ch> *>(const_cast<xml_node<Ch> *>(node));
-                }
-                node = node->parent().ptr_unsafe();
-            }
-            return nullptr;
+            return m_document;
+        }
+
+        //! Gets the document which allocated the node, whether or not it is within that document's tree.
+        //! Nodes allocated from a standalone memory_pool have none, and use the document that contains them.
+        //! \return Pointer to document, or 0 if there is none.
+        optional_ptr<xml_document<Ch>> allocator() const
+        {
+            if (this->m_allocator) return this->m_allocator;
+            return document();
         }
 
         flxml::children<Ch> children() const {
@@ -1036,12 +1214,21 @@ namespace flxml
                 // Assume "same XMLNS".
                 xmlns = this->xmlns();
             }
-            for (xml_node<Ch> *child = m_first_node; child; child = child->m_next_sibling) {
+            if (m_index && !name.empty()) {
+                for (xml_node<Ch> *child = index_first(name); child; child = child->m_next_named)
+                    if (xmlns.empty() || child->xmlns() == xmlns)
+                        return child;
+                return nullptr;
+            }
+            std::size_t scanned = 0;
+            for (xml_node<Ch> *child = m_first_node; child; child = child->m_next_sibling, ++scanned) {
                 if ((name.empty() || child->name() == name)
                     && (xmlns.empty() || child->xmlns() == xmlns)) {
+                    index_if_wide(name, scanned);
                     return child;
                 }
             }
+            index_if_wide(name, scanned);
             return nullptr;
         }
 
@@ -1060,12 +1247,21 @@ namespace flxml
                 // Assume "same XMLNS".
                 xmlns = this->xmlns();
             }
-            for (xml_node<Ch> *child = m_last_node; child; child = child->m_prev_sibling) {
+            if (m_index && !name.empty()) {
+                for (xml_node<Ch> *child = index_last(name); child; child = child->m_prev_named)
+                    if (xmlns.empty() || child->xmlns() == xmlns)
+                        return child;
+                return nullptr;
+            }
+            std::size_t scanned = 0;
+            for (xml_node<Ch> *child = m_last_node; child; child = child->m_prev_sibling, ++scanned) {
                 if ((name.empty() || child->name() == name)
                     && (xmlns.empty() || child->xmlns() == xmlns)) {
+                    index_if_wide(name, scanned);
                     return child;
                 }
             }
+            index_if_wide(name, scanned);
             return nullptr;
         }
 
@@ -1087,10 +1283,20 @@ namespace flxml
                     // Assume "same XMLNS".
                     xmlns = this->xmlns();
                 }
-                for (xml_node<Ch> *sibling = m_prev_sibling; sibling; sibling = sibling->m_prev_sibling)
+                if (this->m_parent->m_index && !name.empty() && name == this->name()) {
+                    for (xml_node<Ch> *sibling = m_prev_named; sibling; sibling = sibling->m_prev_named)
+                        if (xmlns.empty() || sibling->xmlns() == xmlns)
+                            return sibling;
+                    return nullptr;
+                }
+                std::size_t scanned = 0;
+                for (xml_node<Ch> *sibling = m_prev_sibling; sibling; sibling = sibling->m_prev_sibling, ++scanned)
                     if ((name.empty() || sibling->name() == name)
-                        && (xmlns.empty() || sibling->xmlns() == xmlns))
+                        && (xmlns.empty() || sibling->xmlns() == xmlns)) {
+                        this->m_parent->index_if_wide(name, scanned);
                         return sibling;
+                    }
+                this->m_parent->index_if_wide(name, scanned);
                 return nullptr;
             }
             else
@@ -1114,10 +1320,20 @@ namespace flxml
                 // Assume "same XMLNS".
                 xmlns = this->xmlns();
             }
-            for (xml_node<Ch> *sibling = m_next_sibling; sibling; sibling = sibling->m_next_sibling)
+            if (this->m_parent->m_index && !name.empty() && name == this->name()) {
+                for (xml_node<Ch> *sibling = m_next_named; sibling; sibling = sibling->m_next_named)
+                    if (xmlns.empty() || sibling->xmlns() == xmlns)
+                        return sibling;
+                return nullptr;
+            }
+            std::size_t scanned = 0;
+            for (xml_node<Ch> *sibling = m_next_sibling; sibling; sibling = sibling->m_next_sibling, ++scanned)
                 if ((name.empty() || sibling->name() == name)
-                    && (xmlns.empty() || sibling->xmlns() == xmlns))
+                    && (xmlns.empty() || sibling->xmlns() == xmlns)) {
+                    this->m_parent->index_if_wide(name, scanned);
                     return sibling;
+                }
+            this->m_parent->index_if_wide(name, scanned);
             return nullptr;
         }
 
@@ -1167,20 +1383,20 @@ namespace flxml
         //! \param name Name of the element, either string view, string, or clarke notation
     protected: // These are too easy to accidentally forget to append, prepend, or insert.
         optional_ptr<xml_node<Ch>> allocate_element(view_type const & name) {
-            return document()->allocate_node(node_element, name);
+            return allocator()->allocate_node(node_element, name);
         }
         optional_ptr<xml_node<Ch>> allocate_element(std::tuple<view_type,view_type> const & clark_name) {
             auto [xmlns, name] = clark_name;
             xml_node<Ch> * child;
             if (xmlns != this->xmlns()) {
-                child = document()->allocate_node(node_element, name);
-                child->append_attribute(document()->allocate_attribute("xmlns", xmlns));
+                child = allocator()->allocate_node(node_element, name);
+                child->append_attribute(allocator()->allocate_attribute("xmlns", xmlns));
             } else if (!this->prefix().empty()) {
                 std::basic_string<Ch> pname = std::string(this->prefix()) + ':';
                 pname += name;
-                child = document()->allocate_node(node_element, document()->allocate_string(pname));
+                child = allocator()->allocate_node(node_element, allocator()->allocate_string(pname));
             } else {
-                child = document()->allocate_node(node_element, name);
+                child = allocator()->allocate_node(node_element, name);
             }
             return child;
         }
@@ -1227,6 +1443,8 @@ namespace flxml
             m_first_node = child;
             child->m_parent = this;
             child->m_prev_sibling = 0;
+            index_prepend(child);
+            adopt(child);
             return child;
         }
         auto prepend_node(optional_ptr<xml_node<Ch>> ptr) {
@@ -1252,19 +1470,8 @@ namespace flxml
         {
             assert(child && !child->parent() && child->type() != node_document);
             dirty();
-            if (first_node())
-            {
-                child->m_prev_sibling = m_last_node;
-                m_last_node->m_next_sibling = child;
-            }
-            else
-            {
-                child->m_prev_sibling = nullptr;
-                m_first_node = child;
-            }
-            m_last_node = child;
-            child->m_parent = this;
-            child->m_next_sibling = nullptr;
+            link_node(child);
+            adopt(child);
             return child;
         }
         optional_ptr<xml_node<Ch>> append_node(optional_ptr<xml_node<Ch>> ptr) {
@@ -1303,6 +1510,8 @@ namespace flxml
                 where->m_prev_sibling->m_next_sibling = child;
                 where->m_prev_sibling = child;
                 child->m_parent = this;
+                index_insert(child);
+                adopt(child);
             }
             return child;
         }
@@ -1330,12 +1539,14 @@ namespace flxml
             assert(first_node());
             dirty();
             xml_node<Ch> *child = m_first_node;
+            index_remove(child);
             m_first_node = child->m_next_sibling;
             if (child->m_next_sibling)
                 child->m_next_sibling->m_prev_sibling = nullptr;
             else
                 m_last_node = nullptr;
             child->m_parent = nullptr;
+            release(child);
         }
 
         //! Removes last child of the node.
@@ -1346,6 +1557,7 @@ namespace flxml
             assert(first_node());
             dirty();
             xml_node<Ch> *child = m_last_node;
+            index_remove(child);
             if (child->m_prev_sibling)
             {
                 m_last_node = child->m_prev_sibling;
@@ -1354,6 +1566,7 @@ namespace flxml
             else
                 m_first_node = nullptr;
             child->m_parent = nullptr;
+            release(child);
         }
 
         //! Removes specified child from the node
@@ -1369,9 +1582,11 @@ namespace flxml
                 remove_last_node();
             else
             {
+                index_remove(where.get());
                 where->m_prev_sibling->m_next_sibling = where->m_next_sibling;
                 where->m_next_sibling->m_prev_sibling = where->m_prev_sibling;
                 where->m_parent = nullptr;
+                release(where.get());
             }
         }
 
@@ -1382,9 +1597,11 @@ namespace flxml
             dirty();
             for (xml_node<Ch> *node = m_first_node; node; node = node->m_next_sibling) {
                 node->m_parent = nullptr;
+                release(node);
             }
             m_first_node = nullptr;
             m_last_node = nullptr;
+            index_clear();
         }
 
         //! Prepends a new attribute to the node.
@@ -1392,7 +1609,7 @@ namespace flxml
         void prepend_attribute(xml_attribute<Ch> *attribute)
         {
             assert(attribute && !attribute->parent());
-            dirty_parent();
+            dirty_start_tag();
             if (first_attribute())
             {
                 attribute->m_next_attribute = m_first_attribute;
@@ -1406,6 +1623,7 @@ namespace flxml
             m_first_attribute = attribute;
             attribute->m_parent = this;
             attribute->m_prev_attribute = nullptr;
+            if (auto doc = document()) doc->index_id(attribute);
         }
 
         //! Appends a new attribute to the node.
@@ -1413,7 +1631,7 @@ namespace flxml
         void append_attribute(xml_attribute<Ch> *attribute)
         {
             assert(attribute && !attribute->parent());
-            dirty_parent();
+            dirty_start_tag();
             if (first_attribute())
             {
                 attribute->m_prev_attribute = m_last_attribute;
@@ -1427,6 +1645,7 @@ namespace flxml
             m_last_attribute = attribute;
             attribute->m_parent = this;
             attribute->m_next_attribute = nullptr;
+            if (auto doc = document()) doc->index_id(attribute);
         }
 
         //! Inserts a new attribute at specified place inside the node.
@@ -1437,7 +1656,7 @@ namespace flxml
         {
             assert(!where || where->parent() == this);
             assert(attribute && !attribute->parent());
-            dirty_parent();
+            dirty_start_tag();
             if (where == m_first_attribute)
                 prepend_attribute(attribute);
             else if (!where)
@@ -1449,6 +1668,7 @@ namespace flxml
                 where->m_prev_attribute->m_next_attribute = attribute;
                 where->m_prev_attribute = attribute;
                 attribute->m_parent = this;
+                if (auto doc = document()) doc->index_id(attribute);
             }
         }
 
@@ -1458,8 +1678,9 @@ namespace flxml
         void remove_first_attribute()
         {
             assert(first_attribute());
-            dirty_parent();
+            dirty_start_tag();
             xml_attribute<Ch> *attribute = m_first_attribute;
+            if (auto doc = document()) doc->unindex_id(attribute);
             if (attribute->m_next_attribute)
             {
                 attribute->m_next_attribute->m_prev_attribute = 0;
@@ -1476,8 +1697,9 @@ namespace flxml
         void remove_last_attribute()
         {
             assert(first_attribute());
-            dirty_parent();
+            dirty_start_tag();
             xml_attribute<Ch> *attribute = m_last_attribute;
+            if (auto doc = document()) doc->unindex_id(attribute);
             if (attribute->m_prev_attribute)
             {
                 attribute->m_prev_attribute->m_next_attribute = 0;
@@ -1493,13 +1715,14 @@ namespace flxml
         void remove_attribute(optional_ptr<xml_attribute<Ch>> where)
         {
             assert(first_attribute() && where->parent() == this);
-            dirty_parent();
+            dirty_start_tag();
             if (where == m_first_attribute)
                 remove_first_attribute();
             else if (where == m_last_attribute)
                 remove_last_attribute();
             else
             {
+                if (auto doc = document()) doc->unindex_id(where.get());
                 where->m_prev_attribute->m_next_attribute = where->m_next_attribute;
                 where->m_next_attribute->m_prev_attribute = where->m_prev_attribute;
                 where->m_parent = nullptr;
@@ -1510,8 +1733,10 @@ namespace flxml
         void remove_all_attributes()
         {
             if (!m_first_attribute) return;
-            dirty_parent();
+            dirty_start_tag();
+            auto doc = document();
             for (xml_attribute<Ch> *attribute = m_first_attribute; attribute; attribute = attribute->m_next_attribute) {
+                if (doc) doc->unindex_id(attribute);
                 attribute->m_parent = nullptr;
             }
             m_first_attribute = nullptr;
@@ -1525,25 +1750,256 @@ namespace flxml
                  child = child->next_sibling()) {
                 child->validate();
             }
-            for (auto attribute = first_attribute();
-                 attribute;
-                 attribute = attribute->m_next_attribute) {
-                attribute->xmlns();
-                for (auto otherattr = first_attribute();
-                     otherattr != attribute;
-                     otherattr = otherattr->m_next_attribute) {
-                    if (attribute->name() == otherattr->name()) {
-                        throw duplicate_attribute("Attribute doubled");
+            validate_attributes();
+        }
+
+        //! Checks attributes of this node for unbound prefixes and duplicates.
+        //! Small attribute sets are compared pairwise; larger ones (over FLXML_ATTRIBUTE_HASH_THRESHOLD)
+        //! use an open-addressed hash set, so the check stays linear in the number of attributes.
+        void validate_attributes() const
+        {
+            std::size_t count = 0;
+            for (auto attribute = m_first_attribute; attribute; attribute = attribute->m_next_attribute) {
+                ++count;
+            }
+            if (count <= FLXML_ATTRIBUTE_HASH_THRESHOLD) {
+                for (auto attribute = m_first_attribute;
+                     attribute;
+                     attribute = attribute->m_next_attribute) {
+                    attribute->xmlns();
+                    for (auto otherattr = m_first_attribute;
+                         otherattr != attribute;
+                         otherattr = otherattr->m_next_attribute) {
+                        check_duplicate_attribute(attribute, otherattr);
                     }
-                    if ((attribute->local_name() == otherattr->local_name())
-                        && (attribute->xmlns() == otherattr->xmlns()))
-                        throw duplicate_attribute("Attribute XMLNS doubled");
                 }
+                return;
+            }
+            // Table is at most half full, so probe sequences stay short.
+            std::size_t size = 1;
+            while (size < count * 2) size <<= 1;
+            std::vector<const xml_attribute<Ch> *> table(size, nullptr);
+            for (auto attribute = m_first_attribute; attribute; attribute = attribute->m_next_attribute) {
+                auto const & xmlns = attribute->xmlns();
+                auto const & local_name = attribute->local_name();
+                std::size_t slot = (std::hash<view_type>{}(local_name) ^ (std::hash<view_type>{}(xmlns) * 31)) & (size - 1);
+                while (table[slot]) {
+                    check_duplicate_attribute(attribute, table[slot]);
+                    slot = (slot + 1) & (size - 1);
+                }
+                table[slot] = attribute;
             }
         }
 
     private:
 
+        // Brings a newly linked subtree into this node's document, and its IDs into that document's index.
+        void adopt(xml_node<Ch> *child)
+        {
+            if (child->m_document != m_document)
+                child->move_subtree(m_document);
+        }
+
+        // Takes a newly unlinked subtree out of its document, and its IDs out of that document's index.
+        void release(xml_node<Ch> *child)
+        {
+            if (child->m_document)
+                child->move_subtree(nullptr);
+        }
+
+        // Records the document containing this node and its descendants, without recursion.
+        void move_subtree(xml_document<Ch> *doc)
+        {
+            for (xml_node<Ch> *node = this; node; ) {
+                if (node->m_document) node->m_document->unindex_ids(node);
+                node->m_document = doc;
+                if (doc) doc->index_ids(node);
+                if (node->m_first_node) {
+                    node = node->m_first_node;
+                    continue;
+                }
+                while (node != this && !node->m_next_sibling) node = node->m_parent;
+                node = node == this ? nullptr : node->m_next_sibling;
+            }
+        }
+
+        // Appends a child without marking anything dirty; used by append_node() and the parser.
+        xml_node<Ch> *link_node(xml_node<Ch> *child)
+        {
+            if (first_node())
+            {
+                child->m_prev_sibling = m_last_node;
+                m_last_node->m_next_sibling = child;
+            }
+            else
+            {
+                child->m_prev_sibling = nullptr;
+                m_first_node = child;
+            }
+            m_last_node = child;
+            child->m_parent = this;
+            child->m_next_sibling = nullptr;
+            index_append(child);
+            return child;
+        }
+
+        // Sets the value without marking anything dirty; used by the parser.
+        void value_low(view_type const & v) {
+            m_value = v;
+            this->value_raw("");
+        }
+
+        ///////////////////////////////////////////////////////////////////////////
+        // Child name index
+
+        // Wide nodes keep an open-addressed table from child name to the first and last child of that name.
+        // Children with the same name are chained through m_prev_named and m_next_named, in document order.
+        struct name_index_entry
+        {
+            view_type name;
+            xml_node<Ch> *first = nullptr;
+            xml_node<Ch> *last = nullptr;
+        };
+
+        struct name_index
+        {
+            std::span<name_index_entry> entries;
+            std::size_t used = 0;
+        };
+
+        static name_index_entry *index_slot(std::span<name_index_entry> entries, view_type const & name)
+        {
+            std::size_t mask = entries.size() - 1;
+            for (std::size_t slot = std::hash<view_type>{}(name) & mask; ; slot = (slot + 1) & mask) {
+                auto & entry = entries[slot];
+                if (entry.name.empty() || entry.name == name)
+                    return &entry;
+            }
+        }
+
+        name_index_entry *index_entry(view_type const & name, bool create) const
+        {
+            // An index over only unnamed children has no table yet.
+            if (!create && m_index->entries.empty()) return nullptr;
+            if (create && (m_index->used + 1) * 2 > m_index->entries.size()) {
+                // Grow; the old table stays in the pool until it is cleared.
+                auto old = m_index->entries;
+                m_index->entries = allocator()->template allocate_array<name_index_entry>(old.empty() ? 16 : old.size() * 2);
+                for (auto const & entry : old)
+                    if (!entry.name.empty())
+                        *index_slot(m_index->entries, entry.name) = entry;
+            }
+            auto *entry = index_slot(m_index->entries, name);
+            if (entry->name.empty()) {
+                if (!create) return nullptr;
+                entry->name = name;
+                ++m_index->used;
+            }
+            return entry;
+        }
+
+        xml_node<Ch> *index_first(view_type const & name) const
+        {
+            auto *entry = index_entry(name, false);
+            return entry ? entry->first : nullptr;
+        }
+
+        xml_node<Ch> *index_last(view_type const & name) const
+        {
+            auto *entry = index_entry(name, false);
+            return entry ? entry->last : nullptr;
+        }
+
+        void index_append(xml_node<Ch> *child) const
+        {
+            if (!m_index || child->name().empty()) return;
+            auto *entry = index_entry(child->name(), true);
+            child->m_prev_named = entry->last;
+            child->m_next_named = nullptr;
+            if (entry->last) entry->last->m_next_named = child;
+            else entry->first = child;
+            entry->last = child;
+        }
+
+        void index_prepend(xml_node<Ch> *child) const
+        {
+            if (!m_index || child->name().empty()) return;
+            auto *entry = index_entry(child->name(), true);
+            child->m_prev_named = nullptr;
+            child->m_next_named = entry->first;
+            if (entry->first) entry->first->m_prev_named = child;
+            else entry->last = child;
+            entry->first = child;
+        }
+
+        // Links a child already placed among its siblings into the index; the nearer of a same-named sibling
+        // or an end of the children is found by walking both ways at once.
+        void index_insert(xml_node<Ch> *child) const
+        {
+            if (!m_index || child->name().empty()) return;
+            auto *entry = index_entry(child->name(), true);
+            xml_node<Ch> *before = child->m_prev_sibling;
+            xml_node<Ch> *after = child->m_next_sibling;
+            while (true) {
+                if (!before || before->name() == child->name()) {
+                    // Either the same-named sibling it follows, or none precede it.
+                    child->m_prev_named = before;
+                    child->m_next_named = before ? before->m_next_named : entry->first;
+                    break;
+                }
+                if (!after || after->name() == child->name()) {
+                    child->m_next_named = after;
+                    child->m_prev_named = after ? after->m_prev_named : entry->last;
+                    break;
+                }
+                before = before->m_prev_sibling;
+                after = after->m_next_sibling;
+            }
+            if (child->m_prev_named) child->m_prev_named->m_next_named = child;
+            else entry->first = child;
+            if (child->m_next_named) child->m_next_named->m_prev_named = child;
+            else entry->last = child;
+        }
+
+        // Empties the index, keeping its table for reuse.
+        void index_clear() const
+        {
+            if (!m_index) return;
+            for (auto & entry : m_index->entries) entry = {};
+            m_index->used = 0;
+        }
+
+        void index_remove(xml_node<Ch> *child) const
+        {
+            if (!m_index || child->name().empty()) return;
+            auto *entry = index_entry(child->name(), false);
+            if (child->m_prev_named) child->m_prev_named->m_next_named = child->m_next_named;
+            else entry->first = child->m_next_named;
+            if (child->m_next_named) child->m_next_named->m_prev_named = child->m_prev_named;
+            else entry->last = child->m_prev_named;
+        }
+
+        // Called after a named lookup had to scan past a number of children; builds the index if that was too many.
+        void index_if_wide(view_type const & name, std::size_t scanned) const
+        {
+            if (m_index || name.empty() || scanned <= FLXML_CHILD_INDEX_THRESHOLD) return;
+            auto doc = allocator();
+            if (!doc) return;
+            m_index = doc->template allocate_array<name_index>(1).data();
+            for (xml_node<Ch> *child = m_first_node; child; child = child->m_next_sibling)
+                index_append(child);
+        }
+
+        static void check_duplicate_attribute(const xml_attribute<Ch> * attribute, const xml_attribute<Ch> * otherattr)
+        {
+            if (attribute->name() == otherattr->name()) {
+                throw duplicate_attribute("Attribute doubled");
+            }
+            if ((attribute->local_name() == otherattr->local_name())
+                && (attribute->xmlns() == otherattr->xmlns()))
+                throw duplicate_attribute("Attribute XMLNS doubled");
+        }
+
         ///////////////////////////////////////////////////////////////////////////
         // Restrictions
 
@@ -1566,6 +2022,7 @@ namespace flxml
         view_type m_prefix;
         mutable std::optional<view_type> m_xmlns; // Cache
         node_type m_type;                       // Type of node; always valid
+        xml_document<Ch> *m_document = nullptr;           // Document whose tree contains this node, or 0 if none
         xml_node<Ch> *m_first_node = nullptr;             // Pointer to first child node, or 0 if none; always valid
         xml_node<Ch> *m_last_node = nullptr;              // Pointer to last child node, or 0 if none; this value is only valid if m_first_node is non-zero
         xml_attribute<Ch> *m_first_attribute = nullptr;   // Pointer to first attribute of node, or 0 if none; always valid
@@ -1573,8 +2030,16 @@ namespace flxml
         xml_node<Ch> *m_prev_sibling = nullptr;           // Pointer to previous sibling of node, or 0 if none; this value is only valid if m_parent is non-zero
         xml_node<Ch> *m_next_sibling = nullptr;           // Pointer to next sibling of node, or 0 if none; this value is only valid if m_parent is non-zero
         view_type m_contents;                   // Pointer to original contents in buffer.
+        view_type m_start_tag;                  // Parsed start tag less its closing, or empty if not parsed or modified since
+        view_type m_printed;                    // Printed contents, or empty if not cached or changed since
+        std::span<Ch> m_print_storage;          // Pool memory holding the printed contents, kept for refills
+        bool m_print_cache = false;             // Whether to cache printed contents
         bool m_clean = false; // Unchanged since parsing (ie, contents are good).
+        bool m_dirty_pending = false;   // Queued by a mutation_batch, or already marked while it ends.
         mutable std::optional<view_type> m_value;
+        mutable name_index *m_index = nullptr;          // Index of children by name, or 0 if not (yet) built
+        xml_node<Ch> *m_prev_named = nullptr;           // Previous sibling with the same name; only valid if parent has an index
+        xml_node<Ch> *m_next_named = nullptr;           // Next sibling with the same name; only valid if parent has an index
     };
 
     ///////////////////////////////////////////////////////////////////////////
@@ -1590,6 +2055,8 @@ namespace flxml
     template<class Ch = char>
     class xml_document: public xml_node<Ch>, public memory_pool<Ch>
     {
+        friend class xml_node<Ch>;
+        friend class xml_attribute<Ch>;
     public:
         using view_type = std::basic_string_view<Ch>;
         using ptr = optional_ptr<xml_document<Ch>>;
@@ -1598,6 +2065,9 @@ namespace flxml
         xml_document()
             : xml_node<Ch>(node_document)
         {
+            this->m_document = this;
+            this->m_allocator = this;
+            this->m_owner = this;
         }
 
         //! Parses zero-terminated XML string according to given flags.
@@ -1627,6 +2097,28 @@ namespace flxml
             return this->parse_low<Flags>(buffer_ptr<C>(container), parent);
         }
 
+        //! Parses XML held in segments which need not be contiguous, such as a chain of network buffers,
+        //! without first copying them into one buffer. Names, values, start tags and element contents within a segment
+        //! are viewed in place, and those straddling segments are copied into the memory pool, so an element whose
+        //! contents cross a boundary costs a copy of them.
+        //! The segments must persist for the lifetime of the document, and the list of them while the returned position is used.
+        //! \param segments Segments holding the text, in order.
+        //! \return Position after the parsed text.
+        template<int Flags>
+        auto parse(std::span<const view_type> segments, xml_document<Ch> * parent = nullptr) {
+            return this->parse_low<Flags>(segmented_ptr<Ch>(segments), parent);
+        }
+
+        //! Parses XML held in segments, as above, starting from a given position in them.
+        //! A segmented_ptr with a segment_feed lets parsing start before all the segments exist, such as while
+        //! decompressed_file is still decompressing.
+        //! \param text Position of the text to parse.
+        //! \return Position after the parsed text.
+        template<int Flags>
+        auto parse(segmented_ptr<Ch> const & text, xml_document<Ch> * parent = nullptr) {
+            return this->parse_low<Flags>(text, parent);
+        }
+
         template<int Flags, typename T>
         T parse_low(T text, xml_document<Ch> * parent) {
             this->m_parse_flags = Flags;
@@ -1634,6 +2126,7 @@ namespace flxml
             // Remove current contents
             this->remove_all_nodes();
             this->remove_all_attributes();
+            m_ids.clear();
             this->m_parent = parent ? parent->first_node().get() : nullptr;
 
             // Parse BOM, if any
@@ -1643,6 +2136,7 @@ namespace flxml
             while (true)
             {
                 // Skip whitespace before node
+                T space = text;
                 skip<whitespace_pred, Flags>(text);
                 if (*text == 0)
                     break;
@@ -1651,8 +2145,8 @@ namespace flxml
                 if (*text == Ch('<'))
                 {
                     ++text;     // Skip '<'
-                    if (xml_node<Ch> *node = parse_node<Flags>(text)) {
-                        this->append_node(node);
+                    if (xml_node<Ch> *node = parse_node<Flags>(text, space)) {
+                        link_parsed(this, node);
                         if (Flags & (parse_open_only|parse_parse_one) && node->type() == node_element) {
                             break;
                         }
@@ -1671,9 +2165,83 @@ namespace flxml
         {
             this->remove_all_nodes();
             this->remove_all_attributes();
+            m_ids.clear();
+            m_pending.clear();
+            this->m_index = nullptr;    // Held in the pool
+            this->m_printed = {};
+            this->m_print_storage = {};
             memory_pool<Ch>::clear();
         }
 
+        ///////////////////////////////////////////////////////////////////////////
+        // ID index
+
+        //! Sets the name of the attribute which identifies elements, such as "id" or "xml:id".
+        //! Attributes with this name are indexed by value while their elements are within this document's tree,
+        //! as they are parsed, changed, or linked and unlinked along with their subtrees.
+        //! The index is rebuilt from the current tree; an empty name turns indexing off.
+        //! \param name Full name of the ID attribute, including any prefix.
+        void id_attribute(view_type const & name) {
+            m_id_attribute = name;
+            m_ids.clear();
+            if (name.empty()) return;
+            for (xml_node<Ch> *node = this->first_node().ptr_unsafe(); node; ) {
+                for (auto attr = node->first_attribute(); attr; attr = attr->next_attribute())
+                    index_id(attr.get());
+                if (node->first_node()) {
+                    node = node->first_node().get();
+                    continue;
+                }
+                while (node && node != this && !node->next_sibling()) node = node->parent().ptr_unsafe();
+                node = (node && node != this) ? node->next_sibling().get() : nullptr;
+            }
+        }
+
+        //! Gets the name of the attribute which identifies elements.
+        //! \return Name of the ID attribute, or empty if indexing is off.
+        view_type id_attribute() const {
+            return m_id_attribute;
+        }
+
+        //! Finds an element by the value of its ID attribute, in constant time.
+        //! If several elements share an ID, any one of them is found; once it loses the ID, another is.
+        //! \param id Decoded value of the ID attribute.
+        //! \return Pointer to the element, or 0 if no element has this ID.
+        optional_ptr<xml_node<Ch>> element_by_id(view_type const & id) const {
+            auto it = m_ids.find(id);
+            if (it == m_ids.end()) return nullptr;
+            return it->second->parent();
+        }
+
+        ///////////////////////////////////////////////////////////////////////////
+        // Mutation batches
+
+        //! Starts a batch of mutations; see mutation_batch, which should normally be used instead.
+        //! Batches nest, and dirty flags are propagated when the outermost batch ends.
+        void begin_batch() {
+            ++m_batch_depth;
+        }
+
+        //! Ends a batch of mutations.
+        //! When the outermost batch ends, every ancestor of a node mutated during the batch is marked dirty,
+        //! visiting each ancestor once no matter how many of its descendants changed.
+        void end_batch() {
+            assert(m_batch_depth);
+            if (--m_batch_depth) return;
+            // m_pending grows as ancestors are marked, and m_dirty_pending stops each walk at the first node already seen.
+            for (std::size_t i = 0; i != m_pending.size(); ++i) {
+                for (xml_node<Ch> *node = m_pending[i]->m_parent; node && !node->m_dirty_pending; node = node->m_parent) {
+                    node->m_clean = false;
+                    node->m_source = {};
+                    node->m_printed = {};
+                    node->m_dirty_pending = true;
+                    m_pending.push_back(node);
+                }
+            }
+            for (auto *node : m_pending) node->m_dirty_pending = false;
+            m_pending.clear();
+        }
+
         template<int Flags>
         view_type decode_data_value_low(view_type const & v) {
             buffer_ptr first{v};
@@ -1784,6 +2352,7 @@ namespace flxml
             {
                 return internal::lookup_tables::lookup_node_name[static_cast<unsigned char>(ch)];
             }
+            static constexpr bool validated = true;
         };
 
         // Detect element name character
@@ -1793,6 +2362,7 @@ namespace flxml
             {
                 return internal::lookup_tables::lookup_element_name[static_cast<unsigned char>(ch)];
             }
+            static constexpr bool validated = true;
         };
 
         // Detect attribute name character
@@ -1802,6 +2372,7 @@ namespace flxml
             {
                 return internal::lookup_tables::lookup_attribute_name[static_cast<unsigned char>(ch)];
             }
+            static constexpr bool validated = true;
         };
 
         // Detect text character (PCDATA)
@@ -1811,6 +2382,8 @@ namespace flxml
             {
                 return internal::lookup_tables::lookup_text[static_cast<unsigned char>(ch)];
             }
+            static constexpr bool validated = true;
+            static constexpr Ch stops[] = {Ch('<')};
         };
 
         // Detect text character (PCDATA) that does not require processing
@@ -1820,6 +2393,8 @@ namespace flxml
             {
                 return internal::lookup_tables::lookup_text_pure_no_ws[static_cast<unsigned char>(ch)];
             }
+            static constexpr bool validated = true;
+            static constexpr Ch stops[] = {Ch('<'), Ch('&')};
         };
 
         // Detect text character (PCDATA) that does not require processing
@@ -1829,6 +2404,8 @@ namespace flxml
             {
                 return internal::lookup_tables::lookup_text_pure_with_ws[static_cast<unsigned char>(ch)];
             }
+            static constexpr bool validated = true;
+            static constexpr Ch stops[] = {Ch('<'), Ch('&'), Ch(' '), Ch('\t'), Ch('\n'), Ch('\r')};
         };
 
         // Detect attribute value character
@@ -1843,6 +2420,8 @@ namespace flxml
                     return internal::lookup_tables::lookup_attribute_data_2[static_cast<unsigned char>(ch)];
                 return 0;       // Should never be executed, to avoid warnings on Comeau
             }
+            static constexpr bool validated = true;
+            static constexpr Ch stops[] = {Quote};
         };
 
         // Detect attribute value character
@@ -1857,8 +2436,32 @@ namespace flxml
                     return internal::lookup_tables::lookup_attribute_data_2_pure[static_cast<unsigned char>(ch)];
                 return 0;       // Should never be executed, to avoid warnings on Comeau
             }
+            static constexpr bool validated = true;
+            static constexpr Ch stops[] = {Quote, Ch('&')};
         };
 
+        // Check the character reference at text, if it is one, names a Char; references are only expanded later, if
+        // the value is read, so this is where parse_validate_chars sees them
+        template<typename Chp>
+        static void check_character_ref(Chp const & text)
+        {
+            if (text[1] != Ch('#'))
+                return;
+            bool hex = text[2] == Ch('x');
+            unsigned long code = 0;
+            for (std::size_t i = hex ? 3 : 2;; ++i) {
+                unsigned char digit = internal::lookup_tables::lookup_digits[static_cast<unsigned char>(text[i])];
+                if (digit == 0xFF)
+                    break;
+                if (code <= 0x10FFFF)   // Saturate, so long references cannot wrap around to a Char
+                    code = code * (hex ? 16 : 10) + digit;
+            }
+            bool valid = code < 0x20 ? (code == 0x9 || code == 0xA || code == 0xD)
+                       : code < 0xD800 || (code >= 0xE000 && code <= 0x10FFFF && code != 0xFFFE && code != 0xFFFF);
+            if (!valid)
+                FLXML_PARSE_ERROR("invalid character reference", text);
+        }
+
         // Insert coded character, using UTF8 or 8-bit ASCII
         template<int Flags>
         static void insert_coded_character(Ch *&text, unsigned long code)
@@ -1910,10 +2513,130 @@ namespace flxml
         template<class StopPred, int Flags,  typename Chp>
         static void skip(Chp & b)
         {
+            if constexpr ((Flags & parse_validate_chars) != 0 && requires { StopPred::validated; }) {
+                skip_validated<StopPred, Flags>(b);
+                return;
+            }
+            if constexpr (requires { b.next_segment(); }) {
+                // Scan each segment as plain memory, crossing into the next only at its end.
+                do {
+                    auto p = b.it;
+                    while (p != b.end_it && StopPred::test(*p))
+                        ++p;
+                    b.it = p;
+                } while (b.it == b.end_it && b.next_segment());
+                return;
+            }
             while (StopPred::test(*b))
                 ++b;
         }
 
+        // Step over one character, checking it if parse_validate_chars is given
+        template<int Flags, typename Chp>
+        static void step(Chp & text)
+        {
+            if constexpr ((Flags & parse_validate_chars) != 0)
+                step_validated<Flags>(text);
+            else
+                ++text;
+        }
+
+        // Check the character at text is a Char, and in well-formed UTF-8 if it is a sequence, then step over it
+        template<int Flags, typename Chp>
+        static void step_validated(Chp & text)
+        {
+            using unit = std::make_unsigned_t<Ch>;
+            unit lead = static_cast<unit>(*text);
+            if (lead < 0x20) {
+                if (lead != 0x9 && lead != 0xA && lead != 0xD) FLXML_PARSE_ERROR("invalid character", text);
+                ++text;
+                return;
+            }
+            if (lead < 0x80 || (Flags & parse_no_utf8)) {
+                ++text;
+                return;
+            }
+            if constexpr (sizeof(Ch) != 1) {
+                // Wider characters are taken as code points, or UTF-16 code units.
+                if (lead == 0xFFFE || lead == 0xFFFF || lead > 0x10FFFF || (sizeof(Ch) > 2 && lead >= 0xD800 && lead < 0xE000))
+                    FLXML_PARSE_ERROR("invalid character", text);
+                ++text;
+            } else {
+                unsigned long code;
+                int size;
+                if (lead >= 0xC2 && lead < 0xE0) {
+                    code = lead & 0x1F;
+                    size = 2;
+                } else if (lead >= 0xE0 && lead < 0xF0) {
+                    code = lead & 0x0F;
+                    size = 3;
+                } else if (lead >= 0xF0 && lead < 0xF5) {
+                    code = lead & 0x07;
+                    size = 4;
+                } else {
+                    FLXML_PARSE_ERROR("invalid UTF-8", text);
+                }
+                // A NUL, or the end of bounded input, is not a continuation byte, so this stops there.
+                for (int i = 1; i != size; ++i) {
+                    unit next = static_cast<unit>(text[i]);
+                    if ((next & 0xC0) != 0x80) FLXML_PARSE_ERROR("invalid UTF-8", text);
+                    code = (code << 6) | (next & 0x3F);
+                }
+                // Overlong forms, surrogates and code points beyond Unicode are not UTF-8, and Char excludes U+FFFE and U+FFFF.
+                if ((size == 3 && code < 0x800) || (size == 4 && (code < 0x10000 || code > 0x10FFFF)))
+                    FLXML_PARSE_ERROR("invalid UTF-8", text);
+                if ((code >= 0xD800 && code < 0xE000) || code == 0xFFFE || code == 0xFFFF)
+                    FLXML_PARSE_ERROR("invalid character", text);
+                text += size;
+            }
+        }
+
+        // Skip as skip() does, checking each character as step_validated() does
+        template<class StopPred, int Flags, typename Chp>
+        static void skip_validated(Chp & text)
+        {
+            while (true) {
+#if defined(__SSE2__) && !defined(FLXML_NO_SIMD)
+                if constexpr (sizeof(Ch) == 1 && requires { StopPred::stops; text.end_it; }) {
+                    // Bounded input can be read ahead safely; pass over blocks of 16 characters which are
+                    // all printable ASCII, tab, LF or CR, and none of which stop the scan.
+                    const __m128i space = _mm_set1_epi8(0x20);
+                    while (text.end_it - text.it >= 16) {
+                        __m128i chars = _mm_loadu_si128(reinterpret_cast<const __m128i *>(&*text.it));
+                        // Signed comparison catches both controls and bytes of 0x80 and over.
+                        __m128i attention = _mm_cmplt_epi8(chars, space);
+                        attention = _mm_andnot_si128(_mm_or_si128(_mm_or_si128(
+                                _mm_cmpeq_epi8(chars, _mm_set1_epi8(0x9)),
+                                _mm_cmpeq_epi8(chars, _mm_set1_epi8(0xA))),
+                                _mm_cmpeq_epi8(chars, _mm_set1_epi8(0xD))), attention);
+                        attention = _mm_or_si128(attention, _mm_cmpeq_epi8(chars, _mm_set1_epi8('&')));
+                        for (Ch stop : StopPred::stops)
+                            attention = _mm_or_si128(attention, _mm_cmpeq_epi8(chars, _mm_set1_epi8(stop)));
+                        if (int mask = _mm_movemask_epi8(attention)) {
+                            text += std::countr_zero(static_cast<unsigned>(mask));
+                            break;
+                        }
+                        text += 16;
+                    }
+                }
+#endif
+                // Printable ASCII needs nothing beyond the stop test, except for the start of a reference.
+                for (auto ch = static_cast<std::make_unsigned_t<Ch>>(*text); ch >= 0x20 && ch < 0x80 && ch != '&'; ch = static_cast<std::make_unsigned_t<Ch>>(*text)) {
+                    if (!StopPred::test(*text))
+                        return;
+                    ++text;
+                }
+                if (!StopPred::test(*text))
+                    return;
+                if (*text == Ch('&')) {
+                    check_character_ref(text);
+                    ++text;
+                    continue;
+                }
+                step_validated<Flags>(text);
+            }
+        }
+
         // Skip characters until predicate evaluates to true while doing the following:
         // - replacing XML character entity references with proper characters (&apos; &amp; &quot; &lt; &gt; &#...;)
         // - condensing whitespace sequences to single space character
@@ -2064,6 +2787,33 @@ namespace flxml
         ///////////////////////////////////////////////////////////////////////
         // Internal parsing functions
 
+        // Test whether parsed text lies in one piece of the input, so it can be viewed where it is.
+        template<typename Chp>
+        static bool contiguous(Chp const & start, Chp const & end)
+        {
+            if constexpr (requires { start.contiguous_end(end); })
+                return start.contiguous_end(end) != nullptr;
+            else
+                return true;
+        }
+
+        // View parsed text from start to end.
+        // Text straddling segments of segmented input is copied into the pool; all else is viewed in place.
+        template<typename Chp>
+        view_type parsed_view(Chp const & start, Chp const & end)
+        {
+            if constexpr (requires { start.contiguous_end(end); }) {
+                if (const Ch *last = start.contiguous_end(end))
+                    return view_type{start.it, last};
+                auto copy = this->template allocate_array<Ch>(static_cast<std::size_t>(end - start));
+                Chp p = start;
+                for (Ch & c : copy) c = *p++;
+                return view_type{copy.data(), copy.size()};
+            } else {
+                return view_type{start, end};
+            }
+        }
+
         // Parse BOM, if any
         template<int Flags, typename Chp>
         void parse_bom(Chp &texta)
@@ -2089,7 +2839,7 @@ namespace flxml
                 while (text[0] != Ch('?') || text[1] != Ch('>'))
                 {
                     if (!text[0]) FLXML_PARSE_ERROR("unexpected end of data", text);
-                    ++text;
+                    step<Flags>(text);
                 }
                 text += 2;    // Skip '?>'
                 return 0;
@@ -2099,10 +2849,11 @@ namespace flxml
             xml_node<Ch> *declaration = this->allocate_node(node_declaration);
 
             // Skip whitespace before attributes or ?>
+            Chp space = text;
             skip<whitespace_pred, Flags>(text);
 
             // Parse declaration attributes
-            parse_node_attributes<Flags>(text, declaration);
+            parse_node_attributes<Flags>(text, declaration, space);
 
             // Skip ?>
             if (text[0] != Ch('?') || text[1] != Ch('>')) FLXML_PARSE_ERROR("expected ?>", text);
@@ -2122,7 +2873,7 @@ namespace flxml
                 while (text[0] != Ch('-') || text[1] != Ch('-') || text[2] != Ch('>'))
                 {
                     if (!text[0]) FLXML_PARSE_ERROR("unexpected end of data", text);
-                    ++text;
+                    step<Flags>(text);
                 }
                 text += 3;     // Skip '-->'
                 return 0;      // Do not produce comment node
@@ -2135,12 +2886,12 @@ namespace flxml
             while (text[0] != Ch('-') || text[1] != Ch('-') || text[2] != Ch('>'))
             {
                 if (!text[0]) FLXML_PARSE_ERROR("unexpected end of data", text);
-                ++text;
+                step<Flags>(text);
             }
 
             // Create comment node
             xml_node<Ch> *comment = this->allocate_node(node_comment);
-            comment->value({value, text});
+            comment->value_low(parsed_view(value, text));
 
             text += 3;     // Skip '-->'
             return comment;
@@ -2196,7 +2947,7 @@ namespace flxml
             {
                 // Create a new doctype node
                 xml_node<Ch> *doctype = this->allocate_node(node_doctype);
-                doctype->value({value, text});
+                doctype->value_low(parsed_view(value, text));
 
                 text += 1;      // skip '>'
                 return doctype;
@@ -2223,7 +2974,7 @@ namespace flxml
                 Chp name = text;
                 skip<node_name_pred, Flags>(text);
                 if (text == name) FLXML_PARSE_ERROR("expected PI target", text);
-                pi->name({name, text});
+                pi->name(parsed_view(name, text));
 
                 // Skip whitespace between pi target and pi
                 skip<whitespace_pred, Flags>(text);
@@ -2236,11 +2987,11 @@ namespace flxml
                 {
                     if (*text == Ch('\0'))
                         FLXML_PARSE_ERROR("unexpected end of data", text);
-                    ++text;
+                    step<Flags>(text);
                 }
 
                 // Set pi value (verbatim, no entity expansion or whitespace normalization)
-                pi->value({value, text});
+                pi->value_low(parsed_view(value, text));
 
                 text += 2;                          // Skip '?>'
                 return pi;
@@ -2252,7 +3003,7 @@ namespace flxml
                 {
                     if (*text == Ch('\0'))
                         FLXML_PARSE_ERROR("unexpected end of data", text);
-                    ++text;
+                    step<Flags>(text);
                 }
                 text += 2;    // Skip '?>'
                 return 0;
@@ -2272,27 +3023,34 @@ namespace flxml
             // Skip until end of data. We should check if the contents will need decoding.
             Chp value = text;
             bool encoded = false;
-            skip<text_pure_no_ws_pred,0>(text);
+            skip<text_pure_no_ws_pred, Flags & (parse_validate_chars | parse_no_utf8)>(text);
             if (text_pred::test(*text)) {
                 encoded = true;
-                skip<text_pred,0>(text);
+                skip<text_pred, Flags & (parse_validate_chars | parse_no_utf8)>(text);
             }
 
+            view_type raw = parsed_view(value, text);
+
             // If characters are still left between end and value (this test is only necessary if normalization is enabled)
             // Create new data node
             if (!(Flags & parse_no_data_nodes))
             {
                 xml_node<Ch> *data = this->allocate_node(node_data);
-                data->value_raw({value, text});
-                if (!encoded) data->value(data->value_raw());
-                node->append_node(data);
+                data->value_raw(raw);
+                if (contiguous(value, text)) {
+                    data->m_source = raw;
+                    data->m_clean = true;
+                }
+                data->m_source_space = parsed_view(contents_start, value);
+                if (!encoded) data->value_low(data->value_raw());
+                link_parsed(node, data);
             }
 
             // Add data to parent node if no data exists yet
             if (!(Flags & parse_no_element_values)) {
                 if (node->value_raw().empty()) {
-                    node->value_raw({value, text});
-                    if (!encoded) node->value(node->value_raw());
+                    node->value_raw(raw);
+                    if (!encoded) node->value_low(node->value_raw());
                 }
             }
 
@@ -2312,7 +3070,7 @@ namespace flxml
                 {
                     if (!text[0])
                         FLXML_PARSE_ERROR("unexpected end of data", text);
-                    ++text;
+                    step<Flags>(text);
                 }
                 text += 3;      // Skip ]]>
                 return 0;       // Do not produce CDATA node
@@ -2324,51 +3082,72 @@ namespace flxml
             {
                 if (!text[0])
                     FLXML_PARSE_ERROR("unexpected end of data", text);
-                ++text;
+                step<Flags>(text);
             }
 
             // Create new cdata node
             xml_node<Ch> *cdata = this->allocate_node(node_cdata);
-            cdata->value({value, text});
+            cdata->value_low(parsed_view(value, text));
 
             text += 3;      // Skip ]]>
             return cdata;
         }
 
-        // Parse element node
+        // Parse element start tag, up to the > or />
         template<int Flags, typename Chp>
-        xml_node<Ch> *parse_element(Chp &text)
+        xml_node<Ch> *parse_element_start(Chp &text, view_type & qname)
         {
+            Chp start = text - 1;   // Include '<'
             // Create element node
             xml_node<Ch> *element = this->allocate_node(node_element);
 
             // Extract element name
             Chp prefix = text;
-            view_type qname;
             skip<element_name_pred, Flags>(text);
             if (text == prefix)
                 FLXML_PARSE_ERROR("expected element name or prefix", text);
-            if (*text == Ch(':')) {
-                element->prefix({prefix, text});
+            bool prefixed = *text == Ch(':');
+            if (prefixed) {
                 ++text;
                 Chp name = text;
                 skip<node_name_pred, Flags>(text);
                 if (text == name)
                     FLXML_PARSE_ERROR("expected element local name", text);
-                element->name({name, text});
+            }
+            // The prefix and local name are split from the qualified name, so it is only copied once if it must be.
+            qname = parsed_view(prefix, text);
+            if (prefixed) {
+                auto colon = qname.find(Ch(':'));
+                element->prefix(qname.substr(0, colon));
+                element->name(qname.substr(colon + 1));
             } else {
-                element->name({prefix, text});
+                element->name(qname);
             }
-            qname = {prefix, text};
 
             // Skip whitespace between element name and attributes or >
+            Chp space = text;
             skip<whitespace_pred, Flags>(text);
 
             // Parse attributes, if any
-            parse_node_attributes<Flags>(text, element);
+            parse_node_attributes<Flags>(text, element, space);
             // Once we have all the attributes, we should be able to fully validate:
             if (Flags & parse_validate_xmlns) this->validate();
 
+            // Record the start tag up to its last attribute, so it can be copied while the children change.
+            view_type start_tag = parsed_view(start, text);
+            while (!start_tag.empty() && whitespace_pred::test(start_tag.back()))
+                start_tag.remove_suffix(1);
+            element->m_start_tag = start_tag;
+            return element;
+        }
+
+        // Parse element node
+        template<int Flags, typename Chp>
+        xml_node<Ch> *parse_element(Chp &text)
+        {
+            view_type qname;
+            xml_node<Ch> *element = parse_element_start<Flags>(text, qname);
+
             // Determine ending type
             if (*text == Ch('>'))
             {
@@ -2376,7 +3155,8 @@ namespace flxml
                 Chp contents_end = contents;
                 if (!(Flags & parse_open_only))
                     contents_end = parse_node_contents<Flags>(text, element, qname);
-                if (contents != contents_end) element->contents({contents, contents_end});
+                if (contents != contents_end)
+                    element->contents(parsed_view(contents, contents_end));
             }
             else if (*text == Ch('/'))
             {
@@ -2396,7 +3176,30 @@ namespace flxml
 
         // Determine node type, and parse it
         template<int Flags, typename Chp>
-        xml_node<Ch> *parse_node(Chp &text)
+        xml_node<Ch> *parse_node(Chp &text, Chp space)
+        {
+            Chp start = text - 1;   // Include '<'
+            xml_node<Ch> *node = parse_node_low<Flags>(text);
+            // Record where the node came from, so it can be copied while unmodified.
+            // An open-only element has not been parsed in full, so has no usable source.
+            if (node && !(node->type() == node_element && (Flags & parse_open_only)))
+                record_source(node, start, text, space);
+            return node;
+        }
+
+        // Record where the node came from, from its start (including '<') to its end, after the whitespace preceding it.
+        // A node straddling segments of segmented input has no source, and is printed from the tree.
+        template<typename Chp>
+        void record_source(xml_node<Ch> *node, Chp start, Chp end, Chp space)
+        {
+            node->m_source_space = parsed_view(space, start);
+            if (!contiguous(start, end)) return;
+            node->m_source = parsed_view(start, end);
+            node->m_clean = true;
+        }
+
+        template<int Flags, typename Chp>
+        xml_node<Ch> *parse_node_low(Chp &text)
         {
             // Parse proper node type
             switch (text[0])
@@ -2484,10 +3287,22 @@ namespace flxml
 
         // Parse contents of the node - children, data etc.
         // Return end pointer.
+        // Child elements are parsed here too, with their open ancestors on an explicit stack rather than by recursion,
+        // so that hostile nesting cannot exhaust the call stack; nesting deeper than FLXML_MAX_DEPTH is an error.
         template<int Flags, typename Chp>
         Chp parse_node_contents(Chp &text, xml_node<Ch> *node, view_type const & qname)
         {
-            Chp retval;
+            // An element whose contents are being parsed, below node
+            struct open_element {
+                xml_node<Ch> *element;
+                view_type qname;
+                Chp start;          // The '<' of its start tag
+                Chp space;          // The whitespace before that
+                Chp contents;       // The first character after its start tag
+            };
+            std::vector<open_element> open;
+            xml_node<Ch> *parent = node;
+            Chp retval = text;
             // For all children and text
             while (true)
             {
@@ -2518,7 +3333,7 @@ namespace flxml
                             // Skip and validate closing tag name
                             Chp closing_name = text;
                             skip<node_name_pred, Flags>(text);
-                            if (qname != view_type{closing_name, text})
+                            if ((open.empty() ? qname : open.back().qname) != parsed_view(closing_name, text))
                                 FLXML_PARSE_ERROR("invalid closing tag name", text);
                         }
                         else
@@ -2531,22 +3346,59 @@ namespace flxml
                         if (*text != Ch('>'))
                             FLXML_PARSE_ERROR("expected >", text);
                         ++text;     // Skip '>'
-                        if (Flags & parse_open_only)
-                            FLXML_PARSE_ERROR("Unclosed element actually closed.", text);
-                        return retval;     // Node closed, finished parsing contents
+                        if (open.empty()) {
+                            if (Flags & parse_open_only)
+                                FLXML_PARSE_ERROR("Unclosed element actually closed.", text);
+                            return retval;     // Node closed, finished parsing contents
+                        }
+                        // A child element closed; finish it as parse_element() and parse_node() would, and carry on with its parent.
+                        auto child = open.back();
+                        if (child.contents != retval)
+                            child.element->contents(parsed_view(child.contents, retval));
+                        record_source(child.element, child.start, text, child.space);
+                        open.pop_back();
+                        parent = open.empty() ? node : open.back().element;
+                        link_parsed(parent, child.element);
+                    }
+                    else if (text[1] != Ch('?') && text[1] != Ch('!'))
+                    {
+                        // Child element
+                        Chp start = text;
+                        ++text;     // Skip '<'
+                        view_type child_qname;
+                        xml_node<Ch> *element = parse_element_start<Flags & ~parse_open_only>(text, child_qname);
+                        if (*text == Ch('>'))
+                        {
+                            if (open.size() + 1 >= FLXML_MAX_DEPTH)
+                                FLXML_PARSE_ERROR("elements nested too deeply", text);
+                            ++text;
+                            open.push_back({element, child_qname, start, contents_start, text});
+                            parent = element;
+                        }
+                        else if (*text == Ch('/'))
+                        {
+                            ++text;
+                            if (*text != Ch('>'))
+                                FLXML_PARSE_ERROR("expected >", text);
+                            ++text;
+                            record_source(element, start, text, contents_start);
+                            link_parsed(parent, element);
+                        }
+                        else
+                            FLXML_PARSE_ERROR("expected >", text);
                     }
                     else
                     {
                         // Child node
                         ++text;     // Skip '<'
-                        if (xml_node<Ch> *child = parse_node<Flags & ~parse_open_only>(text))
-                            node->append_node(child);
+                        if (xml_node<Ch> *child = parse_node<Flags & ~parse_open_only>(text, contents_start))
+                            link_parsed(parent, child);
                     }
                     break;
 
                 // End of data - error unless we expected this.
                 case Ch('\0'):
-                    if (Flags & parse_open_only) {
+                    if ((Flags & parse_open_only) && open.empty()) {
                         return Chp();
                     } else {
                         FLXML_PARSE_ERROR("unexpected end of data", text);
@@ -2554,30 +3406,32 @@ namespace flxml
 
                 // Data node
                 default:
-                    next_char = parse_and_append_data<Flags>(node, text, contents_start);
+                    next_char = parse_and_append_data<Flags>(parent, text, contents_start);
+                    contents_start = text;  // Data runs up to the next node, with no whitespace between
                     goto after_data_node;   // Bypass regular processing after data nodes
 
                 }
             }
         }
 
-        // Parse XML attributes of the node
+        // Parse XML attributes of the node; space is where the whitespace before the first one starts
         template<int Flags, typename Chp>
-        void parse_node_attributes(Chp &text, xml_node<Ch> *node)
+        void parse_node_attributes(Chp &text, xml_node<Ch> *node, Chp space)
         {
+            // The node is not linked yet, but its ID attributes belong in this document's index.
+            node->m_document = this;
             // For all attributes
             while (attribute_name_pred::test(*text))
             {
                 // Extract attribute name
                 Chp name = text;
-                ++text;     // Skip first character of attribute name
+                step<Flags>(text);     // Skip first character of attribute name
                 skip<attribute_name_pred, Flags>(text);
                 if (text == name)
                     FLXML_PARSE_ERROR("expected attribute name", name);
 
                 // Create new attribute
-                xml_attribute<Ch> *attribute = this->allocate_attribute(view_type{name, text});
-                node->append_attribute(attribute);
+                xml_attribute<Ch> *attribute = this->allocate_attribute(parsed_view(name, text));
 
                 // Skip whitespace after attribute name
                 skip<whitespace_pred, Flags>(text);
@@ -2608,19 +3462,93 @@ namespace flxml
                 end = text;
 
                 // Set attribute value
-                attribute->value_raw({value, end});
+                attribute->value_raw(parsed_view(value, end));
+                node->append_attribute(attribute);
 
                 // Make sure that end quote is present
                 if (*text != quote)
                     FLXML_PARSE_ERROR("expected ' or \"", text);
                 ++text;     // Skip quote
+                if (contiguous(name, text))
+                    attribute->m_source = parsed_view(name, text);
+                attribute->m_source_space = parsed_view(space, name);
+                space = text;
 
                 // Skip whitespace after attribute value
                 skip<whitespace_pred, Flags>(text);
             }
         }
     private:
+        // Links a parsed node; its descendants were parsed into this document too, so none need visiting.
+        void link_parsed(xml_node<Ch> *parent, xml_node<Ch> *child) {
+            child->m_document = this;
+            parent->link_node(child);
+        }
+
+        bool defer_dirty(xml_node<Ch> *node) {
+            if (!m_batch_depth) return false;
+            if (!node->m_dirty_pending) {
+                node->m_dirty_pending = true;
+                m_pending.push_back(node);
+            }
+            return true;
+        }
+
+        void index_id(xml_attribute<Ch> *attr) {
+            if (m_id_attribute.empty() || attr->name() != m_id_attribute) return;
+            m_ids.emplace(attr->value(), attr);
+        }
+
+        void unindex_id(xml_attribute<Ch> *attr) {
+            if (m_id_attribute.empty() || attr->name() != m_id_attribute) return;
+            auto [it, end] = m_ids.equal_range(attr->value());
+            for (; it != end; ++it) {
+                if (it->second == attr) {
+                    m_ids.erase(it);
+                    return;
+                }
+            }
+        }
+
+        void index_ids(xml_node<Ch> *node) {
+            if (m_id_attribute.empty()) return;
+            for (auto attr = node->m_first_attribute; attr; attr = attr->m_next_attribute)
+                index_id(attr);
+        }
+
+        void unindex_ids(xml_node<Ch> *node) {
+            if (m_id_attribute.empty()) return;
+            for (auto attr = node->m_first_attribute; attr; attr = attr->m_next_attribute)
+                unindex_id(attr);
+        }
+
         int m_parse_flags = 0;
+        std::basic_string<Ch> m_id_attribute;                              // Name of the ID attribute, or empty if not indexing
+        std::unordered_multimap<view_type, xml_attribute<Ch> *> m_ids;     // Indexed ID attribute values
+        unsigned m_batch_depth = 0;                                         // Nesting depth of mutation batches
+        std::vector<xml_node<Ch> *> m_pending;                              // Nodes dirtied during the current batch
+    };
+
+    //! Scope guard which defers propagation of dirty flags while a document is being mutated.
+    //! Without a batch, each mutation marks every ancestor dirty, so building or editing N nodes at depth d costs O(N*d).
+    //! Within a batch, mutated nodes are queued and their ancestors are marked once, when the outermost batch ends.
+    //! Until then, ancestors of mutated nodes may still report clean(), so do not print the document inside a batch.
+    //! Nodes outside the document's tree mark their ancestors as usual.
+    template<typename Ch = char>
+    class mutation_batch
+    {
+    public:
+        explicit mutation_batch(xml_document<Ch> & doc) : m_document(doc) {
+            m_document.begin_batch();
+        }
+        mutation_batch(mutation_batch const &) = delete;
+        mutation_batch & operator = (mutation_batch const &) = delete;
+        ~mutation_batch() {
+            m_document.end_batch();
+        }
+
+    private:
+        xml_document<Ch> & m_document;
     };
 
 
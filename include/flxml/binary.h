@@ -0,0 +1,554 @@
+#ifndef FLXML_BINARY_HPP_INCLUDED
+#define FLXML_BINARY_HPP_INCLUDED
+
+//! \file binary.h This file contains a binary form for parsed documents, which loads without parsing.
+
+#include <flxml.h>
+#include <flxml/utils.h>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include <stdexcept>
+
+namespace flxml
+{
+
+    //! Thrown when binary document data is malformed, or was written for a different platform or character type.
+    class binary_error : public std::runtime_error
+    {
+    public:
+        using std::runtime_error::runtime_error;
+    };
+
+    //! \cond internal
+    namespace internal
+    {
+        // The binary form is a header, then node and attribute tables, then a string table of Ch.
+        // Tables refer to each other by index and to strings by offset, so the data can be used where it is mapped.
+        // Nodes are stored breadth-first, so each node's children are contiguous; the document node is first.
+        // Everything is in native byte order; the byte order field lets a mismatch be detected.
+
+        constexpr std::uint32_t binary_version = 1;
+        constexpr std::uint32_t binary_byte_order = 0x01020304;
+        constexpr std::uint32_t binary_none = ~std::uint32_t(0);
+
+        struct binary_header
+        {
+            char magic[4];
+            std::uint32_t version;
+            std::uint32_t byte_order;
+            std::uint32_t char_size;
+            std::uint32_t node_count;
+            std::uint32_t attribute_count;
+            std::uint32_t string_size;
+            std::uint32_t reserved;
+        };
+
+        struct binary_string
+        {
+            std::uint32_t offset;
+            std::uint32_t size;
+        };
+
+        struct binary_node_record
+        {
+            std::uint32_t type;
+            binary_string name;
+            binary_string prefix;
+            binary_string xmlns;
+            binary_string value;
+            std::uint32_t parent;
+            std::uint32_t first_child;
+            std::uint32_t child_count;
+            std::uint32_t first_attribute;
+            std::uint32_t attribute_count;
+        };
+
+        struct binary_attribute_record
+        {
+            binary_string name;
+            binary_string xmlns;
+            binary_string value;
+            std::uint32_t parent;
+        };
+
+        constexpr char binary_magic[4] = {'F', 'L', 'X', 'B'};
+    }
+    //! \endcond
+
+    //! Writes a document in binary form, for loading with binary_document.
+    //! Names, namespaces and decoded values are stored, with repeated strings stored once; source text,
+    //! and anything else tied to the parse, is not.
+    //! \param out Output iterator to write bytes to, such as std::ostreambuf_iterator<char>.
+    //! \param doc Document to write.
+    //! \return Output iterator pointing to the byte after the last byte written.
+    template<class OutIt, class Ch>
+    inline OutIt write_binary(OutIt out, const xml_document<Ch> & doc)
+    {
+        using namespace internal;
+        using view_type = std::basic_string_view<Ch>;
+        std::vector<binary_node_record> nodes;
+        std::vector<binary_attribute_record> attributes;
+        std::basic_string<Ch> strings;
+        std::unordered_map<view_type, std::uint32_t> offsets;
+        auto check = [](std::size_t n) {
+            if (n >= binary_none) throw binary_error("document too large for binary form");
+            return static_cast<std::uint32_t>(n);
+        };
+        auto intern = [&](view_type const & s) -> binary_string {
+            if (s.empty()) return {0, 0};
+            auto [it, added] = offsets.try_emplace(s, 0);
+            if (added) {
+                it->second = check(strings.size());
+                strings += s;
+            }
+            return {it->second, check(s.size())};
+        };
+
+        // Breadth-first, appending each node's children as it is reached.
+        std::vector<const xml_node<Ch> *> order{&doc};
+        for (std::size_t i = 0; i != order.size(); ++i) {
+            const xml_node<Ch> *node = order[i];
+            binary_node_record record{};
+            record.type = static_cast<std::uint32_t>(node->type());
+            record.name = intern(node->name());
+            record.prefix = intern(node->prefix());
+            if (node->type() == node_element)
+                record.xmlns = intern(node->xmlns());
+            record.value = intern(node->value());
+            record.parent = binary_none;
+            record.first_child = check(order.size());
+            for (auto child = node->first_node(); child; child = child->next_sibling()) {
+                order.push_back(child.get());
+                ++record.child_count;
+            }
+            record.first_attribute = check(attributes.size());
+            for (auto attr = node->first_attribute(); attr; attr = attr->next_attribute()) {
+                attributes.push_back({intern(attr->name()), intern(attr->xmlns()), intern(attr->value()), check(i)});
+                ++record.attribute_count;
+            }
+            nodes.push_back(record);
+        }
+        // Parents are filled in from the children ranges.
+        for (std::size_t i = 0; i != nodes.size(); ++i)
+            for (std::uint32_t c = 0; c != nodes[i].child_count; ++c)
+                nodes[nodes[i].first_child + c].parent = static_cast<std::uint32_t>(i);
+
+        binary_header header{};
+        std::memcpy(header.magic, binary_magic, sizeof(header.magic));
+        header.version = binary_version;
+        header.byte_order = binary_byte_order;
+        header.char_size = sizeof(Ch);
+        header.node_count = check(nodes.size());
+        header.attribute_count = check(attributes.size());
+        header.string_size = check(strings.size());
+        auto bytes = [&out](const void *data, std::size_t size) {
+            out = std::copy_n(static_cast<const char *>(data), size, out);
+        };
+        bytes(&header, sizeof(header));
+        bytes(nodes.data(), nodes.size() * sizeof(binary_node_record));
+        bytes(attributes.data(), attributes.size() * sizeof(binary_attribute_record));
+        bytes(strings.data(), strings.size() * sizeof(Ch));
+        return out;
+    }
+
+    template<typename Ch> class binary_document;
+    template<typename Ch> class binary_attribute;
+
+    //! Read-only node within a binary_document.
+    //! Navigation mirrors xml_node, returning handles which test false when there is no such node,
+    //! and which give access through -> as well as directly.
+    template<typename Ch = char>
+    class binary_node
+    {
+    public:
+        using view_type = std::basic_string_view<Ch>;
+
+        binary_node() = default;
+        binary_node(const binary_document<Ch> *doc, std::uint32_t index) : m_document(doc), m_index(index) {}
+
+        explicit operator bool() const
+        {
+            return m_document != nullptr;
+        }
+
+        const binary_node * operator->() const
+        {
+            if (!m_document) throw no_such_node();
+            return this;
+        }
+
+        bool operator == (binary_node const &) const = default;
+
+        node_type type() const
+        {
+            return static_cast<node_type>(record().type);
+        }
+        view_type name() const
+        {
+            return m_document->string(record().name);
+        }
+        view_type prefix() const
+        {
+            return m_document->string(record().prefix);
+        }
+        view_type xmlns() const
+        {
+            return m_document->string(record().xmlns);
+        }
+        view_type value() const
+        {
+            return m_document->string(record().value);
+        }
+
+        binary_node parent() const
+        {
+            return node(record().parent);
+        }
+
+        //! Gets the first child node, optionally matching name and namespace, as xml_node::first_node().
+        binary_node first_node(view_type const & name = {}, view_type const & asked_xmlns = {}) const
+        {
+            auto const & r = record();
+            view_type xmlns = namespace_for(name, asked_xmlns);
+            for (std::uint32_t i = r.first_child; i != r.first_child + r.child_count; ++i)
+                if (binary_node child = node(i); child.matches(name, xmlns))
+                    return child;
+            return {};
+        }
+
+        //! Gets the last child node, optionally matching name and namespace.
+        binary_node last_node(view_type const & name = {}, view_type const & asked_xmlns = {}) const
+        {
+            auto const & r = record();
+            view_type xmlns = namespace_for(name, asked_xmlns);
+            for (std::uint32_t i = r.first_child + r.child_count; i != r.first_child; --i)
+                if (binary_node child = node(i - 1); child.matches(name, xmlns))
+                    return child;
+            return {};
+        }
+
+        //! Gets the next sibling node, optionally matching name and namespace, as xml_node::next_sibling().
+        binary_node next_sibling(view_type const & name = {}, view_type const & asked_xmlns = {}) const
+        {
+            auto const & p = parent_record();
+            view_type xmlns = namespace_for(name, asked_xmlns);
+            for (std::uint32_t i = m_index + 1; i < p.first_child + p.child_count; ++i)
+                if (binary_node sibling = node(i); sibling.matches(name, xmlns))
+                    return sibling;
+            return {};
+        }
+
+        //! Gets the previous sibling node, optionally matching name and namespace.
+        binary_node previous_sibling(view_type const & name = {}, view_type const & asked_xmlns = {}) const
+        {
+            auto const & p = parent_record();
+            view_type xmlns = namespace_for(name, asked_xmlns);
+            for (std::uint32_t i = m_index; i > p.first_child; --i)
+                if (binary_node sibling = node(i - 1); sibling.matches(name, xmlns))
+                    return sibling;
+            return {};
+        }
+
+        //! Gets the first attribute, optionally matching name and namespace, as xml_node::first_attribute().
+        binary_attribute<Ch> first_attribute(view_type const & name = {}, view_type const & xmlns = {}) const
+        {
+            auto const & r = record();
+            for (std::uint32_t i = r.first_attribute; i != r.first_attribute + r.attribute_count; ++i)
+                if (binary_attribute<Ch> attr{m_document, i}; attr.matches(name, xmlns))
+                    return attr;
+            return {};
+        }
+
+        //! Range over child nodes.
+        class child_range
+        {
+        public:
+            class iterator
+            {
+            public:
+                using value_type = binary_node;
+                using reference = binary_node;
+                using iterator_category = std::forward_iterator_tag;
+                using difference_type = std::ptrdiff_t;
+
+                iterator() = default;
+                iterator(const binary_document<Ch> *doc, std::uint32_t index) : m_document(doc), m_index(index) {}
+                binary_node operator *() const { return {m_document, m_index}; }
+                iterator & operator++() { ++m_index; return *this; }
+                iterator operator++(int) { auto tmp = *this; ++m_index; return tmp; }
+                bool operator == (iterator const &) const = default;
+            private:
+                const binary_document<Ch> *m_document = nullptr;
+                std::uint32_t m_index = 0;
+            };
+            child_range(const binary_document<Ch> *doc, std::uint32_t first, std::uint32_t count) : m_document(doc), m_first(first), m_count(count) {}
+            iterator begin() const { return {m_document, m_first}; }
+            iterator end() const { return {m_document, m_first + m_count}; }
+            std::size_t size() const { return m_count; }
+        private:
+            const binary_document<Ch> *m_document;
+            std::uint32_t m_first;
+            std::uint32_t m_count;
+        };
+
+        //! Range over attributes.
+        class attribute_range
+        {
+        public:
+            class iterator
+            {
+            public:
+                using value_type = binary_attribute<Ch>;
+                using reference = binary_attribute<Ch>;
+                using iterator_category = std::forward_iterator_tag;
+                using difference_type = std::ptrdiff_t;
+
+                iterator() = default;
+                iterator(const binary_document<Ch> *doc, std::uint32_t index) : m_document(doc), m_index(index) {}
+                binary_attribute<Ch> operator *() const { return {m_document, m_index}; }
+                iterator & operator++() { ++m_index; return *this; }
+                iterator operator++(int) { auto tmp = *this; ++m_index; return tmp; }
+                bool operator == (iterator const &) const = default;
+            private:
+                const binary_document<Ch> *m_document = nullptr;
+                std::uint32_t m_index = 0;
+            };
+            attribute_range(const binary_document<Ch> *doc, std::uint32_t first, std::uint32_t count) : m_document(doc), m_first(first), m_count(count) {}
+            iterator begin() const { return {m_document, m_first}; }
+            iterator end() const { return {m_document, m_first + m_count}; }
+            std::size_t size() const { return m_count; }
+        private:
+            const binary_document<Ch> *m_document;
+            std::uint32_t m_first;
+            std::uint32_t m_count;
+        };
+
+        child_range children() const
+        {
+            auto const & r = record();
+            return {m_document, r.first_child, r.child_count};
+        }
+
+        attribute_range attributes() const
+        {
+            auto const & r = record();
+            return {m_document, r.first_attribute, r.attribute_count};
+        }
+
+    private:
+        friend class binary_document<Ch>;
+
+        internal::binary_node_record const & record() const
+        {
+            if (!m_document) throw no_such_node();
+            return m_document->m_nodes[m_index];
+        }
+
+        internal::binary_node_record const & parent_record() const
+        {
+            auto const & r = record();
+            assert(r.parent != internal::binary_none);     // Cannot query for siblings if node has no parent
+            return m_document->m_nodes[r.parent];
+        }
+
+        binary_node node(std::uint32_t index) const
+        {
+            if (index == internal::binary_none) return {};
+            return {m_document, index};
+        }
+
+        // No namespace asked for, but a name is present: assume the same namespace, as xml_node does.
+        view_type namespace_for(view_type const & name, view_type const & asked_xmlns) const
+        {
+            if (asked_xmlns.empty() && !name.empty()) return xmlns();
+            return asked_xmlns;
+        }
+
+        bool matches(view_type const & name, view_type const & xmlns) const
+        {
+            return (name.empty() || this->name() == name) && (xmlns.empty() || this->xmlns() == xmlns);
+        }
+
+        const binary_document<Ch> *m_document = nullptr;
+        std::uint32_t m_index = 0;
+    };
+
+    //! Read-only attribute within a binary_document.
+    template<typename Ch = char>
+    class binary_attribute
+    {
+    public:
+        using view_type = std::basic_string_view<Ch>;
+
+        binary_attribute() = default;
+        binary_attribute(const binary_document<Ch> *doc, std::uint32_t index) : m_document(doc), m_index(index) {}
+
+        explicit operator bool() const
+        {
+            return m_document != nullptr;
+        }
+
+        const binary_attribute * operator->() const
+        {
+            if (!m_document) throw no_such_node();
+            return this;
+        }
+
+        bool operator == (binary_attribute const &) const = default;
+
+        view_type name() const
+        {
+            return m_document->string(record().name);
+        }
+        view_type xmlns() const
+        {
+            return m_document->string(record().xmlns);
+        }
+        view_type value() const
+        {
+            return m_document->string(record().value);
+        }
+
+        binary_node<Ch> parent() const
+        {
+            return {m_document, record().parent};
+        }
+
+        //! Gets the next attribute of the same element, optionally matching name and namespace.
+        binary_attribute next_attribute(view_type const & name = {}, view_type const & xmlns = {}) const
+        {
+            auto const & p = m_document->m_nodes[record().parent];
+            for (std::uint32_t i = m_index + 1; i < p.first_attribute + p.attribute_count; ++i)
+                if (binary_attribute attr{m_document, i}; attr.matches(name, xmlns))
+                    return attr;
+            return {};
+        }
+
+    private:
+        friend class binary_node<Ch>;
+
+        internal::binary_attribute_record const & record() const
+        {
+            if (!m_document) throw no_such_node();
+            return m_document->m_attributes[m_index];
+        }
+
+        bool matches(view_type const & name, view_type const & xmlns) const
+        {
+            return (name.empty() || this->name() == name) && (xmlns.empty() || this->xmlns() == xmlns);
+        }
+
+        const binary_document<Ch> *m_document = nullptr;
+        std::uint32_t m_index = 0;
+    };
+
+    //! Read-only view of a document written by write_binary().
+    //! The data is used where it lies, so loading only checks it; the data must outlive the view and its nodes.
+    //! Navigation starts from the document node, as with xml_document.
+    template<typename Ch = char>
+    class binary_document : public binary_node<Ch>
+    {
+    public:
+        using view_type = std::basic_string_view<Ch>;
+
+        //! Checks binary data and makes a view of it.
+        //! \param data Bytes written by write_binary(), aligned to at least 4 bytes.
+        explicit binary_document(std::string_view const & data) : binary_node<Ch>(this, 0)
+        {
+            using namespace internal;
+            if (reinterpret_cast<std::uintptr_t>(data.data()) % alignof(binary_node_record))
+                throw binary_error("binary document is misaligned");
+            if (data.size() < sizeof(binary_header))
+                throw binary_error("binary document is truncated");
+            binary_header header;
+            std::memcpy(&header, data.data(), sizeof(header));
+            if (std::memcmp(header.magic, binary_magic, sizeof(header.magic)) != 0)
+                throw binary_error("not a binary document");
+            if (header.version != binary_version || header.byte_order != binary_byte_order || header.char_size != sizeof(Ch))
+                throw binary_error("binary document is for a different version or platform");
+            std::size_t size = sizeof(binary_header)
+                               + std::size_t(header.node_count) * sizeof(binary_node_record)
+                               + std::size_t(header.attribute_count) * sizeof(binary_attribute_record)
+                               + std::size_t(header.string_size) * sizeof(Ch);
+            if (data.size() != size || header.node_count == 0)
+                throw binary_error("binary document is truncated");
+            auto p = data.data() + sizeof(binary_header);
+            m_nodes = reinterpret_cast<const binary_node_record *>(p);
+            p += header.node_count * sizeof(binary_node_record);
+            m_attributes = reinterpret_cast<const binary_attribute_record *>(p);
+            p += header.attribute_count * sizeof(binary_attribute_record);
+            m_strings = view_type(reinterpret_cast<const Ch *>(p), header.string_size);
+            m_node_count = header.node_count;
+            m_attribute_count = header.attribute_count;
+            check();
+        }
+
+        binary_document(binary_document const &) = delete;
+        binary_document & operator = (binary_document const &) = delete;
+
+    private:
+        friend class binary_node<Ch>;
+        friend class binary_attribute<Ch>;
+
+        view_type string(internal::binary_string const & s) const
+        {
+            return m_strings.substr(s.offset, s.size);
+        }
+
+        // Check every index and offset once, so navigation needs no checks.
+        void check() const
+        {
+            using namespace internal;
+            auto valid = [this](binary_string const & s) {
+                return s.offset <= m_strings.size() && s.size <= m_strings.size() - s.offset;
+            };
+            if (m_nodes[0].type != static_cast<std::uint32_t>(node_document) || m_nodes[0].parent != binary_none)
+                throw binary_error("binary document has no document node");
+            for (std::uint32_t i = 0; i != m_node_count; ++i) {
+                auto const & r = m_nodes[i];
+                // Children follow their parents, so there are no cycles.
+                bool ok = r.type <= static_cast<std::uint32_t>(node_literal)
+                          && valid(r.name) && valid(r.prefix) && valid(r.xmlns) && valid(r.value)
+                          && (i == 0 || r.parent < i)
+                          && (r.child_count == 0 || (r.first_child > i && r.first_child <= m_node_count && r.child_count <= m_node_count - r.first_child))
+                          && r.first_attribute <= m_attribute_count && r.attribute_count <= m_attribute_count - r.first_attribute;
+                for (std::uint32_t c = 0; ok && c != r.child_count; ++c)
+                    ok = m_nodes[r.first_child + c].parent == i;
+                if (!ok) throw binary_error("binary document is corrupt");
+            }
+            for (std::uint32_t i = 0; i != m_attribute_count; ++i) {
+                auto const & a = m_attributes[i];
+                if (!valid(a.name) || !valid(a.xmlns) || !valid(a.value) || a.parent >= m_node_count
+                    || i < m_nodes[a.parent].first_attribute || i - m_nodes[a.parent].first_attribute >= m_nodes[a.parent].attribute_count)
+                    throw binary_error("binary document is corrupt");
+            }
+        }
+
+        const internal::binary_node_record *m_nodes = nullptr;
+        const internal::binary_attribute_record *m_attributes = nullptr;
+        view_type m_strings;
+        std::uint32_t m_node_count = 0;
+        std::uint32_t m_attribute_count = 0;
+    };
+
+#ifdef FLXML_HAS_MMAP
+    //! Binary document loaded by mapping its file read-only, so startup costs only the check of its tables.
+    template<typename Ch = char>
+    class binary_file : private mapped_file<char>, public binary_document<Ch>
+    {
+    public:
+        //! Maps and checks a file written by write_binary().
+        //! \param filename Filename to map.
+        explicit binary_file(const char *filename)
+            : mapped_file<char>(filename), binary_document<Ch>(mapped_file<char>::view())
+        {
+        }
+    };
+#endif
+
+}
+
+#endif
@@ -7,6 +7,35 @@
 //! \file rapidxml_print.hpp This file contains rapidxml printer implementation
 
 #include <flxml.h>
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+#include <span>
+#include <bit>
+
+// Offer iovec lists for writev() where the platform has them
+#if __has_include(<sys/uio.h>)
+    #include <sys/uio.h>
+    #define FLXML_HAS_IOVEC
+#endif
+
+// Use SSE2 to find characters needing references, unless disabled
+#if defined(__SSE2__) && !defined(FLXML_NO_SIMD)
+    #include <emmintrin.h>
+#endif
+
+// Only include threads if not disabled
+#ifndef FLXML_NO_THREADS
+    #include <atomic>
+    #include <condition_variable>
+    #include <deque>
+    #include <exception>
+    #include <functional>
+    #include <memory>
+    #include <mutex>
+    #include <thread>
+#endif
 
 // Only include streams if not disabled
 #ifndef FLXML_NO_STREAMS
@@ -21,6 +50,262 @@ namespace flxml
     // Printing flags
 
     const int print_no_indenting = 0x1;   //!< Printer flag instructing the printer to suppress indenting of XML. See print() function.
+    const int print_preserve_formatting = 0x2;    //!< Printer flag instructing the printer to keep parsed whitespace and indent only around new nodes; has no effect with print_no_indenting. See print() function.
+    const int print_c14n = 0x4;                   //!< Printer flag instructing the printer to produce Canonical XML 1.0, without comments; other flags are ignored. See print() function.
+    const int print_c14n_exclusive = 0x8;         //!< Printer flag instructing the printer to produce Exclusive XML Canonicalization 1.0, without comments; other flags are ignored. See print() function.
+    const int print_c14n_comments = 0x10;         //!< Printer flag instructing the canonical printer to keep comments; has no effect without print_c14n or print_c14n_exclusive. See print() function.
+
+    ///////////////////////////////////////////////////////////////////////
+    // Print buffer
+
+    template<typename Ch> class print_buffer;
+
+    //! Output iterator appending to a print_buffer.
+    //! The printer recognises it, and appends names, values and clean contents in bulk.
+    template<typename Ch>
+    class print_buffer_iterator
+    {
+    public:
+        using iterator_category = std::output_iterator_tag;
+        using value_type = void;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = void;
+
+        explicit print_buffer_iterator(print_buffer<Ch> & buffer) : m_buffer(&buffer) {}
+
+        print_buffer_iterator & operator *() {
+            return *this;
+        }
+        print_buffer_iterator & operator = (Ch ch) {
+            m_buffer->push_back(ch);
+            return *this;
+        }
+        print_buffer_iterator & operator ++() {
+            return *this;
+        }
+        print_buffer_iterator operator ++(int) {
+            return *this;
+        }
+
+        print_buffer<Ch> & buffer() const {
+            return *m_buffer;
+        }
+
+    private:
+        print_buffer<Ch> *m_buffer;
+    };
+
+    //! Growable contiguous buffer to print into.
+    //! Unlike printing through std::back_inserter, runs of characters are appended with a single copy.
+    //! \param Ch Character type to use.
+    template<typename Ch = char>
+    class print_buffer
+    {
+    public:
+        using view_type = std::basic_string_view<Ch>;
+        using iterator = print_buffer_iterator<Ch>;
+
+        print_buffer() = default;
+        explicit print_buffer(std::size_t capacity) {
+            reserve(capacity);
+        }
+
+        //! Gets an output iterator which appends to this buffer, to pass to print().
+        iterator inserter() {
+            return iterator(*this);
+        }
+
+        //! Ensures the buffer can hold at least the given number of characters without growing.
+        void reserve(std::size_t capacity) {
+            if (capacity <= m_capacity) return;
+            auto data = std::make_unique_for_overwrite<Ch[]>(capacity);
+            if (m_size) std::char_traits<Ch>::copy(data.get(), m_data.get(), m_size);
+            m_data = std::move(data);
+            m_capacity = capacity;
+        }
+
+        void push_back(Ch ch) {
+            if (m_size == m_capacity) grow(1);
+            m_data[m_size++] = ch;
+        }
+
+        void append(const Ch *data, std::size_t n) {
+            if (m_capacity - m_size < n) grow(n);
+            std::char_traits<Ch>::copy(m_data.get() + m_size, data, n);
+            m_size += n;
+        }
+
+        void append(std::size_t n, Ch ch) {
+            if (m_capacity - m_size < n) grow(n);
+            std::char_traits<Ch>::assign(m_data.get() + m_size, n, ch);
+            m_size += n;
+        }
+
+        //! Empties the buffer, keeping its memory for reuse.
+        void clear() {
+            m_size = 0;
+        }
+
+        const Ch *data() const {
+            return m_data.get();
+        }
+        std::size_t size() const {
+            return m_size;
+        }
+        std::size_t capacity() const {
+            return m_capacity;
+        }
+        view_type view() const {
+            return {m_data.get(), m_size};
+        }
+
+    private:
+        void grow(std::size_t n) {
+            reserve(std::max(m_size + n, m_capacity ? m_capacity * 2 : std::size_t(256)));
+        }
+
+        std::unique_ptr<Ch[]> m_data;
+        std::size_t m_size = 0;
+        std::size_t m_capacity = 0;
+    };
+
+    template<typename Ch> class print_gather;
+
+    //! Output iterator recording into a print_gather.
+    //! The printer recognises it, and records names, values and clean contents by reference.
+    template<typename Ch>
+    class print_gather_iterator
+    {
+    public:
+        using iterator_category = std::output_iterator_tag;
+        using value_type = void;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = void;
+
+        explicit print_gather_iterator(print_gather<Ch> & gather) : m_gather(&gather) {}
+
+        print_gather_iterator & operator *() {
+            return *this;
+        }
+        print_gather_iterator & operator = (Ch ch) {
+            m_gather->push_back(ch);
+            return *this;
+        }
+        print_gather_iterator & operator ++() {
+            return *this;
+        }
+        print_gather_iterator operator ++(int) {
+            return *this;
+        }
+
+        print_gather<Ch> & gather() const {
+            return *m_gather;
+        }
+
+    private:
+        print_gather<Ch> *m_gather;
+    };
+
+    //! Scatter/gather output: printed XML as a list of pieces, for writev() or sendmsg().
+    //! Names, values and clean contents of at least copy_limit characters are referenced where they lie,
+    //! in the parsed text or the document's pool; only markup and short strings are copied, into side chunks
+    //! owned here. The pieces are valid while both this and the printed document are alive and unmodified.
+    //! \param Ch Character type to use.
+    template<typename Ch = char>
+    class print_gather
+    {
+    public:
+        using view_type = std::basic_string_view<Ch>;
+        using iterator = print_gather_iterator<Ch>;
+
+        static constexpr std::size_t copy_limit = 32;     //!< Shorter runs are copied rather than referenced
+        static constexpr std::size_t chunk_size = 1024;   //!< Size of each side chunk, in characters
+
+        //! Gets an output iterator which records into this gather, to pass to print().
+        iterator inserter() {
+            return iterator(*this);
+        }
+
+        void push_back(Ch ch) {
+            *side(1) = ch;
+        }
+
+        void append(const Ch *data, std::size_t n) {
+            if (n < copy_limit) {
+                if (n) std::char_traits<Ch>::copy(side(n), data, n);
+                return;
+            }
+            m_pieces.emplace_back(data, n);
+            m_side_last = false;
+            m_size += n;
+        }
+
+        void append(std::size_t n, Ch ch) {
+            while (n) {
+                std::size_t run = std::min(n, chunk_size);
+                std::char_traits<Ch>::assign(side(run), run, ch);
+                n -= run;
+            }
+        }
+
+        //! Empties the gather, keeping the first side chunk for reuse.
+        void clear() {
+            m_pieces.clear();
+            if (m_chunks.size() > 1) m_chunks.resize(1);
+            m_used = 0;
+            m_side_last = false;
+            m_size = 0;
+        }
+
+        //! Gets the pieces, in order.
+        std::span<const view_type> pieces() const {
+            return m_pieces;
+        }
+        //! Gets the total number of characters in all pieces.
+        std::size_t size() const {
+            return m_size;
+        }
+
+#ifdef FLXML_HAS_IOVEC
+        //! Gets the pieces as an iovec list for writev() or sendmsg().
+        //! Callers writing more than IOV_MAX pieces must split the list.
+        std::vector<iovec> iovecs() const {
+            std::vector<iovec> result;
+            result.reserve(m_pieces.size());
+            for (auto const & piece : m_pieces)
+                result.push_back({const_cast<Ch *>(piece.data()), piece.size() * sizeof(Ch)});
+            return result;
+        }
+#endif
+
+    private:
+        // Finds room for n characters in the side chunks, extending the last piece if it ends there.
+        Ch *side(std::size_t n) {
+            if (m_chunks.empty() || chunk_size - m_used < n) {
+                if (m_chunks.empty() || m_used) m_chunks.push_back(std::make_unique_for_overwrite<Ch[]>(chunk_size));
+                m_used = 0;
+                m_side_last = false;
+            }
+            Ch *p = m_chunks.back().get() + m_used;
+            m_used += n;
+            m_size += n;
+            if (m_side_last) {
+                m_pieces.back() = view_type(m_pieces.back().data(), m_pieces.back().size() + n);
+            } else {
+                m_pieces.emplace_back(p, n);
+                m_side_last = true;
+            }
+            return p;
+        }
+
+        std::vector<view_type> m_pieces;
+        std::vector<std::unique_ptr<Ch[]>> m_chunks;
+        std::size_t m_used = 0;
+        std::size_t m_size = 0;
+        bool m_side_last = false;
+    };
 
     ///////////////////////////////////////////////////////////////////////
     // Internal
@@ -31,6 +316,42 @@ namespace flxml
         
         ///////////////////////////////////////////////////////////////////////////
         // Internal character operations
+
+        // Output iterator which only counts the characters written through it, for print_size()
+        class print_counter
+        {
+        public:
+            using iterator_category = std::output_iterator_tag;
+            using value_type = void;
+            using difference_type = std::ptrdiff_t;
+            using pointer = void;
+            using reference = void;
+
+            print_counter & operator *() {
+                return *this;
+            }
+            template<class Ch>
+            print_counter & operator = (Ch) {
+                ++m_count;
+                return *this;
+            }
+            print_counter & operator ++() {
+                return *this;
+            }
+            print_counter operator ++(int) {
+                return *this;
+            }
+
+            void add(std::size_t n) {
+                m_count += n;
+            }
+            std::size_t count() const {
+                return m_count;
+            }
+
+        private:
+            std::size_t m_count = 0;
+        };
     
         // Copy characters from given range to given output iterator
         template<class OutIt, class Ch>
@@ -41,55 +362,140 @@ namespace flxml
             return out;
         }
 
+        // Copy characters into memory the caller has sized, with a single copy
+        template<class Ch>
+        inline Ch *copy_chars(const Ch *begin, const Ch *end, Ch *out)
+        {
+            std::char_traits<Ch>::copy(out, begin, end - begin);
+            return out + (end - begin);
+        }
+
+        // Copy characters into a print_buffer, with a single copy
+        template<class Ch>
+        inline print_buffer_iterator<Ch> copy_chars(const Ch *begin, const Ch *end, print_buffer_iterator<Ch> out)
+        {
+            out.buffer().append(begin, end - begin);
+            return out;
+        }
+
+        // Record characters into a print_gather, by reference where they are long enough
+        template<class Ch>
+        inline print_gather_iterator<Ch> copy_chars(const Ch *begin, const Ch *end, print_gather_iterator<Ch> out)
+        {
+            out.gather().append(begin, end - begin);
+            return out;
+        }
+
+        // Count characters without looking at them
+        template<class Ch>
+        inline print_counter copy_chars(const Ch *begin, const Ch *end, print_counter out)
+        {
+            out.add(end - begin);
+            return out;
+        }
+
         template<class OutIt, class Ch>
         inline OutIt copy_chars(std::basic_string_view<Ch> const & sv, OutIt out) {
             return copy_chars(sv.data(), sv.data() + sv.size(), out);
         }
         
+        // Find the next character which needs expanding into a reference, other than noexpand
+        template<class Ch>
+        inline const Ch *find_expandable(const Ch *begin, const Ch *end, Ch noexpand)
+        {
+            for (; begin != end; ++begin)
+            {
+                Ch ch = *begin;
+                if (ch != noexpand && (ch == Ch('<') || ch == Ch('>') || ch == Ch('\'') || ch == Ch('"') || ch == Ch('&')))
+                    return begin;
+            }
+            return end;
+        }
+
+#if defined(__SSE2__) && !defined(FLXML_NO_SIMD)
+        // As above, testing sixteen characters at a time; the scalar loop handles the tail
+        inline const char *find_expandable(const char *begin, const char *end, char noexpand)
+        {
+            const __m128i lt = _mm_set1_epi8('<');
+            const __m128i gt = _mm_set1_epi8('>');
+            const __m128i apos = _mm_set1_epi8('\'');
+            const __m128i quot = _mm_set1_epi8('"');
+            const __m128i amp = _mm_set1_epi8('&');
+            const __m128i skip = _mm_set1_epi8(noexpand);
+            for (; end - begin >= 16; begin += 16)
+            {
+                __m128i chars = _mm_loadu_si128(reinterpret_cast<const __m128i *>(begin));
+                __m128i found = _mm_or_si128(
+                    _mm_or_si128(_mm_cmpeq_epi8(chars, lt), _mm_cmpeq_epi8(chars, gt)),
+                    _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chars, apos), _mm_cmpeq_epi8(chars, quot)), _mm_cmpeq_epi8(chars, amp)));
+                found = _mm_andnot_si128(_mm_cmpeq_epi8(chars, skip), found);
+                if (unsigned mask = _mm_movemask_epi8(found))
+                    return begin + std::countr_zero(mask);
+            }
+            return find_expandable<char>(begin, end, noexpand);
+        }
+#endif
+
+        // Expand a single character into a reference (&lt; &gt; &apos; &quot; &amp;)
+        template<class OutIt, class Ch>
+        inline OutIt expand_char(Ch ch, OutIt out)
+        {
+            switch (ch)
+            {
+            case Ch('<'):
+                *out++ = Ch('&'); *out++ = Ch('l'); *out++ = Ch('t'); *out++ = Ch(';');
+                break;
+            case Ch('>'): 
+                *out++ = Ch('&'); *out++ = Ch('g'); *out++ = Ch('t'); *out++ = Ch(';');
+                break;
+            case Ch('\''): 
+                *out++ = Ch('&'); *out++ = Ch('a'); *out++ = Ch('p'); *out++ = Ch('o'); *out++ = Ch('s'); *out++ = Ch(';');
+                break;
+            case Ch('"'): 
+                *out++ = Ch('&'); *out++ = Ch('q'); *out++ = Ch('u'); *out++ = Ch('o'); *out++ = Ch('t'); *out++ = Ch(';');
+                break;
+            case Ch('&'): 
+                *out++ = Ch('&'); *out++ = Ch('a'); *out++ = Ch('m'); *out++ = Ch('p'); *out++ = Ch(';'); 
+                break;
+            default:
+                *out++ = ch;    // No expansion, copy character
+            }
+            return out;
+        }
+
         // Copy characters from given range to given output iterator and expand
         // characters into references (&lt; &gt; &apos; &quot; &amp;)
+        // Runs of characters which need no expansion are copied with copy_chars, so in bulk where the output allows.
         template<class OutIt, class Ch>
         inline OutIt copy_and_expand_chars(const Ch *begin, const Ch *end, Ch noexpand, OutIt out)
         {
             while (begin != end)
             {
-                if (*begin == noexpand)
-                {
-                    *out++ = *begin;    // No expansion, copy character
-                }
-                else
-                {
-                    switch (*begin)
-                    {
-                    case Ch('<'):
-                        *out++ = Ch('&'); *out++ = Ch('l'); *out++ = Ch('t'); *out++ = Ch(';');
-                        break;
-                    case Ch('>'): 
-                        *out++ = Ch('&'); *out++ = Ch('g'); *out++ = Ch('t'); *out++ = Ch(';');
-                        break;
-                    case Ch('\''): 
-                        *out++ = Ch('&'); *out++ = Ch('a'); *out++ = Ch('p'); *out++ = Ch('o'); *out++ = Ch('s'); *out++ = Ch(';');
-                        break;
-                    case Ch('"'): 
-                        *out++ = Ch('&'); *out++ = Ch('q'); *out++ = Ch('u'); *out++ = Ch('o'); *out++ = Ch('t'); *out++ = Ch(';');
-                        break;
-                    case Ch('&'): 
-                        *out++ = Ch('&'); *out++ = Ch('a'); *out++ = Ch('m'); *out++ = Ch('p'); *out++ = Ch(';'); 
-                        break;
-                    default:
-                        *out++ = *begin;    // No expansion, copy character
-                    }
-                }
-                ++begin;    // Step to next character
+                const Ch *next = find_expandable(begin, end, noexpand);
+                out = copy_chars(begin, next, out);
+                if (next == end)
+                    break;
+                out = expand_char(*next, out);
+                begin = next + 1;    // Step past expanded character
             }
             return out;
         }
 
+        // Count the expanded length: each reference adds its length less the character it replaces
+        template<class Ch>
+        inline print_counter copy_and_expand_chars(const Ch *begin, const Ch *end, Ch noexpand, print_counter out)
+        {
+            out.add(end - begin);
+            for (begin = find_expandable(begin, end, noexpand); begin != end; begin = find_expandable(begin + 1, end, noexpand))
+                out.add((*begin == Ch('<') || *begin == Ch('>')) ? 3 : (*begin == Ch('&') ? 4 : 5));
+            return out;
+        }
 
         template<class OutIt, class Ch>
         inline OutIt copy_and_expand_chars(std::basic_string_view<Ch> const & sv, Ch noexpand, OutIt out) {
             return copy_and_expand_chars(sv.data(), sv.data() + sv.size(), noexpand, out);
         }
+
         // Fill given output iterator with repetitions of the same character
         template<class OutIt, class Ch>
         inline OutIt fill_chars(OutIt out, int n, Ch ch)
@@ -99,6 +505,35 @@ namespace flxml
             return out;
         }
 
+        template<class Ch>
+        inline Ch *fill_chars(Ch *out, int n, Ch ch)
+        {
+            if (n <= 0) return out;
+            std::char_traits<Ch>::assign(out, n, ch);
+            return out + n;
+        }
+
+        template<class Ch>
+        inline print_buffer_iterator<Ch> fill_chars(print_buffer_iterator<Ch> out, int n, Ch ch)
+        {
+            if (n > 0) out.buffer().append(n, ch);
+            return out;
+        }
+
+        template<class Ch>
+        inline print_gather_iterator<Ch> fill_chars(print_gather_iterator<Ch> out, int n, Ch ch)
+        {
+            if (n > 0) out.gather().append(n, ch);
+            return out;
+        }
+
+        template<class Ch>
+        inline print_counter fill_chars(print_counter out, int n, Ch)
+        {
+            if (n > 0) out.add(n);
+            return out;
+        }
+
         // Find character
         template<class Ch, Ch ch>
         inline bool find_char(const Ch *begin, const Ch *end)
@@ -109,19 +544,119 @@ namespace flxml
             return false;
         }
 
+        // Test whether an unmodified node or attribute follows the given end of another in the source text,
+        // separated only by its original whitespace, so that both can be copied as one range.
+        template<class Ch, class T>
+        inline bool joined(const Ch *end, T const & next)
+        {
+            auto const & source = next->source();
+            return !source.empty() && next->source_space().data() == end;
+        }
+
+        // Find the whitespace the parser kept before a child of an element, which is character data and so is printed
+        // before the child whether or not it was modified; between top-level nodes, or before text, there is none.
+        template<class Ch>
+        inline std::basic_string_view<Ch> sibling_space(const optional_ptr<xml_node<Ch>> child)
+        {
+            if (child->type() == node_data || child->parent()->type() != node_element)
+                return {};
+            return child->source_space();
+        }
+
+        // Test whether the printer should frame each node with indentation and a line break.
+        inline bool indenting(int flags)
+        {
+            return !(flags & (print_no_indenting | print_preserve_formatting));
+        }
+
+        // Find the whitespace at the end of an element's parsed contents, which preceded its end tag.
+        template<class Ch>
+        inline std::basic_string_view<Ch> trailing_space(std::basic_string_view<Ch> const & contents)
+        {
+            std::size_t n = contents.size();
+            while (n && (contents[n - 1] == Ch(' ') || contents[n - 1] == Ch('\t') || contents[n - 1] == Ch('\r') || contents[n - 1] == Ch('\n')))
+                --n;
+            return contents.substr(n);
+        }
+
         ///////////////////////////////////////////////////////////////////////////
         // Internal printing operations
 
         // Print node
         template<class OutIt, class Ch>
         inline OutIt print_node(OutIt out, const optional_ptr<xml_node<Ch>> node, int flags, int indent);
-    
-        // Print children of the node                               
+
+        // Print children of the node
         template<class OutIt, class Ch>
-        inline OutIt print_children(OutIt out, const optional_ptr<xml_node<Ch>> node, int flags, int indent)
+        inline OutIt print_children(OutIt out, const optional_ptr<xml_node<Ch>> node, int flags, int indent);
+
+        // Test whether the children of the node are printed elsewhere; only print_parallel() does this
+        template<class OutIt, class Ch>
+        inline bool skip_children(OutIt const &, const optional_ptr<xml_node<Ch>>)
+        {
+            return false;
+        }
+    
+        // Find the whitespace which preceded the last parsed sibling before the given child, to space new nodes like it
+        template<class Ch>
+        inline std::basic_string_view<Ch> preceding_space(const optional_ptr<xml_node<Ch>> node, const optional_ptr<xml_node<Ch>> first)
+        {
+            for (auto child = first ? first->previous_sibling() : node->last_node(); child; child = child->previous_sibling())
+                if (child->source_space().data())
+                    return child->source_space();
+            return {};
+        }
+
+        // Test whether the node has any data children, which makes it mixed content
+        template<class Ch>
+        inline bool mixed_content(const optional_ptr<xml_node<Ch>> node)
         {
             for (auto child = node->first_node(); child; child = child->next_sibling())
-                out = print_node(out, child, flags, indent);
+                if (child->type() == node_data)
+                    return true;
+            return false;
+        }
+
+        // Find the unit of indentation in parsed whitespace which indents a line to the given depth.
+        // Returns empty if the whitespace does not end a line break and that many copies of one unit.
+        template<class Ch>
+        inline std::basic_string_view<Ch> indent_unit(std::basic_string_view<Ch> const & space, int depth)
+        {
+            auto newline = space.find_last_of(Ch('\n'));
+            if (newline == std::basic_string_view<Ch>::npos || depth <= 0) return {};
+            auto line = space.substr(newline + 1);
+            if (line.empty() || line.size() % depth) return {};
+            auto unit = line.substr(0, line.size() / depth);
+            for (std::size_t i = unit.size(); i != line.size(); i += unit.size())
+                if (line.substr(i, unit.size()) != unit) return {};
+            return unit;
+        }
+
+        // Start a new line indented to the given depth, by the unit found in parsed whitespace or else by tabs
+        template<class OutIt, class Ch>
+        inline OutIt print_line_preserved(OutIt out, int depth, std::basic_string_view<Ch> const & unit)
+        {
+            *out = Ch('\n'), ++out;
+            if (unit.empty())
+                return fill_chars(out, depth, Ch('\t'));
+            for (int i = 0; i < depth; ++i)
+                out = copy_chars(unit, out);
+            return out;
+        }
+
+        // Print the whitespace before the end tag, as it was if it was parsed
+        template<class OutIt, class Ch>
+        inline OutIt print_children_end_preserved(OutIt out, const optional_ptr<xml_node<Ch>> node, int indent, std::basic_string_view<Ch> const & unit = {})
+        {
+            if (node->type() == node_document) {
+                *out = Ch('\n'), ++out;
+            } else if (mixed_content(node)) {
+                // No whitespace which was not there before.
+            } else if (!node->contents().empty()) {
+                out = copy_chars(trailing_space(node->contents()), out);
+            } else {
+                out = print_line_preserved(out, indent - 1, unit);
+            }
             return out;
         }
 
@@ -129,19 +664,37 @@ namespace flxml
         template<class OutIt, class Ch>
         inline OutIt print_attributes(OutIt out, const optional_ptr<xml_node<Ch>> node, int flags)
         {
-            for (auto attribute = node->first_attribute(); attribute; attribute = attribute->next_attribute())
+            const bool copying = flags & (print_no_indenting | print_preserve_formatting);
+            // Copying source, each attribute keeps the whitespace parsed before it, whether or not it was modified.
+            auto space = [copying, &out](const optional_ptr<xml_attribute<Ch>> attribute) {
+                if (copying && !attribute->source_space().empty())
+                    out = copy_chars(attribute->source_space(), out);
+                else
+                    *out = Ch(' '), ++out;
+            };
+            for (auto attribute = node->first_attribute(); attribute;)
             {
+                auto const & source = attribute->source();
+                if (!source.empty() && copying) {
+                    // Copy the longest run of unmodified attributes which were adjacent when parsed.
+                    space(attribute);
+                    const Ch *end = source.data() + source.size();
+                    for (attribute = attribute->next_attribute(); attribute && joined(end, attribute); attribute = attribute->next_attribute())
+                        end = attribute->source().data() + attribute->source().size();
+                    out = copy_chars(source.data(), end, out);
+                    continue;
+                }
                 if (!(attribute->name().empty()) || attribute->value_raw().empty())
                 {
                     // Print attribute name
-                    *out = Ch(' '), ++out;
+                    space(attribute);
                     out = copy_chars(attribute->name(), out);
                     *out = Ch('='), ++out;
                     if (attribute->quote() && !attribute->value_decoded()) {
                         // Shortcut here; just dump out the raw value.
-                        *out++ = attribute->quote();
+                        *out = attribute->quote(), ++out;
                         out = copy_chars(attribute->value_raw(), out);
-                        **out++ = attribute->quote();
+                        *out = attribute->quote(), ++out;
                     } else {
                         // Print attribute value using appropriate quote type
                         if (attribute->value().find('"') != std::basic_string_view<Ch>::npos) {
@@ -155,6 +708,7 @@ namespace flxml
                         }
                     }
                 }
+                attribute = attribute->next_attribute();
             }
             return out;
         }
@@ -164,7 +718,7 @@ namespace flxml
         inline OutIt print_data_node(OutIt out, const optional_ptr<xml_node<Ch>> node, int flags, int indent)
         {
             assert(node->type() == node_type::node_data);
-            if (!(flags & print_no_indenting))
+            if (indenting(flags))
                 out = fill_chars(out, indent, Ch('\t'));
             if (!node->value_decoded()) {
                 out = copy_chars(node->value_raw(), out);
@@ -179,7 +733,7 @@ namespace flxml
         inline OutIt print_cdata_node(OutIt out, const optional_ptr<xml_node<Ch>> node, int flags, int indent)
         {
             assert(node->type() == node_type::node_cdata);
-            if (!(flags & print_no_indenting))
+            if (indenting(flags))
                 out = fill_chars(out, indent, Ch('\t'));
             *out = Ch('<'); ++out;
             *out = Ch('!'); ++out;
@@ -197,86 +751,143 @@ namespace flxml
             return out;
         }
 
-        // Print element node
+        // Print element start tag, or the whole element if it is empty
+        // Returns, in open, whether the element needs an end tag.
         template<class OutIt, class Ch>
-        inline OutIt print_element_node(OutIt out, const optional_ptr<xml_node<Ch>> node, int flags, int indent)
+        inline OutIt print_element_start(OutIt out, const optional_ptr<xml_node<Ch>> node, int flags, int indent, bool & open)
         {
             assert(node->type() == node_type::node_element);
 
             // Print element name and attributes, if any
-            if (!(flags & print_no_indenting))
+            if (indenting(flags))
                 out = fill_chars(out, indent, Ch('\t'));
-            *out = Ch('<'), ++out;
-            if (!node->prefix().empty()) {
-                out = copy_chars(node->prefix(), out);
-                *out = Ch(':'); ++out;
+            if (!node->start_tag().empty() && (flags & (print_no_indenting | print_preserve_formatting))) {
+                // Neither name nor attributes have changed since parsing, so copy them as they were.
+                out = copy_chars(node->start_tag(), out);
+            } else {
+                *out = Ch('<'), ++out;
+                if (!node->prefix().empty()) {
+                    out = copy_chars(node->prefix(), out);
+                    *out = Ch(':'); ++out;
+                }
+                out = copy_chars(node->name(), out);
+                out = print_attributes(out, node, flags);
             }
-            out = copy_chars(node->name(), out);
-            out = print_attributes(out, node, flags);
-            
+
             // If node is childless
-            if (node->value().empty() && !node->first_node())
-            {
+            open = !node->value().empty() || node->first_node();
+            if (!open) {
                 // Print childless node tag ending
                 *out = Ch('/'), ++out;
                 *out = Ch('>'), ++out;
-            }
-            else
-            {
+            } else {
                 // Print normal node tag ending
                 *out = Ch('>'), ++out;
+            }
+            return out;
+        }
 
-                // If the node is clean, just output the contents and move on.
-                // Can only do this if we're not indenting, otherwise pretty-print won't work.
-                if (node->clean() && (flags & print_no_indenting)) {
-                    out = copy_chars(node->contents(), out);
-                } else {
+        // Test whether the element's children are printed one by one, rather than by its contents or value
+        template<class Ch>
+        inline bool prints_children(const optional_ptr<xml_node<Ch>> node, int flags)
+        {
+            // If the node is clean, its contents are copied as they are.
+            // Can only do this if we're not indenting, otherwise pretty-print won't work.
+            if (node->clean() && (flags & (print_no_indenting | print_preserve_formatting)))
+                return false;
+            auto child = node->first_node();
+            return child && (child->next_sibling() || child->type() != node_type::node_data);
+        }
 
-                    // Test if node contains a single data node only (and no other nodes)
-                    auto child = node->first_node();
-                    if (!child) {
-                        // If node has no children, only print its value without indenting
-                        if (!node->value_decoded()) {
-                            out = copy_chars(node->value_raw(), out);
-                        } else {
-                            out = copy_and_expand_chars(node->value(), Ch(0), out);
-                        }
-                    } else if (!child->next_sibling() && child->type() == node_type::node_data) {
-                        // If node has a sole data child, only print its value without indenting
-                        if (!child->value_decoded()) {
-                            out = copy_chars(child->value_raw(), out);
-                        } else {
-                            out = copy_and_expand_chars(child->value(), Ch(0), out);
-                        }
-                    } else {
-                        // Print all children with full indenting
-                        if (!(flags & print_no_indenting))
-                            *out = Ch('\n'), ++out;
-                        out = print_children(out, node, flags, indent + 1);
-                        if (!(flags & print_no_indenting))
-                            out = fill_chars(out, indent, Ch('\t'));
-                    }
-                }
+        // Print the content of an element whose children are not printed one by one
+        template<class OutIt, class Ch>
+        inline OutIt print_element_value(OutIt out, const optional_ptr<xml_node<Ch>> node, int flags)
+        {
+            if (node->clean() && (flags & (print_no_indenting | print_preserve_formatting)))
+                return copy_chars(node->contents(), out);
+            // If node has no children, only print its value; if it has a sole data child, print that without indenting.
+            auto value = node->first_node() ? node->first_node() : node;
+            if (!value->value_decoded())
+                return copy_chars(value->value_raw(), out);
+            return copy_and_expand_chars(value->value(), Ch(0), out);
+        }
 
-                // Print node end
-                *out = Ch('<'), ++out;
-                *out = Ch('/'), ++out;
-                if (!node->prefix().empty()) {
-                    out = copy_chars(node->prefix(), out);
-                    *out = Ch(':'); ++out;
-                }
-                out = copy_chars(node->name(), out);
-                *out = Ch('>'), ++out;
+        // Print element end tag
+        template<class OutIt, class Ch>
+        inline OutIt print_element_end(OutIt out, const optional_ptr<xml_node<Ch>> node)
+        {
+            *out = Ch('<'), ++out;
+            *out = Ch('/'), ++out;
+            if (!node->prefix().empty()) {
+                out = copy_chars(node->prefix(), out);
+                *out = Ch(':'); ++out;
             }
+            out = copy_chars(node->name(), out);
+            *out = Ch('>'), ++out;
             return out;
         }
 
+        // Test whether the element's children are printed through its print cache
+        template<class Ch>
+        inline bool cached_children(const optional_ptr<xml_node<Ch>> node, int flags)
+        {
+            return node->print_cache() && (flags & print_no_indenting);
+        }
+
+        // Fill the element's print cache if it is empty
+        template<class Ch>
+        inline void fill_print_cache(const optional_ptr<xml_node<Ch>> node, int flags, int indent)
+        {
+            if (!node->printed().empty())
+                return;
+            print_buffer<Ch> buffer;
+            print_children(buffer.inserter(), node, flags, indent);
+            optional_ptr<xml_node<Ch>> element = node;
+            element->printed(buffer.view());
+        }
+
+        // Print the element's children from its print cache, filling the cache first if it is empty
+        template<class OutIt, class Ch>
+        inline OutIt print_cached_children(OutIt out, const optional_ptr<xml_node<Ch>> node, int flags, int indent)
+        {
+            // Measuring leaves the cache as it is.
+            if constexpr (std::is_same_v<OutIt, print_counter>) {
+                if (node->printed().empty())
+                    return print_children(out, node, flags, indent);
+            }
+            fill_print_cache(node, flags, indent);
+            return copy_chars(node->printed(), out);
+        }
+
+        // Print element node
+        template<class OutIt, class Ch>
+        inline OutIt print_element_node(OutIt out, const optional_ptr<xml_node<Ch>> node, int flags, int indent)
+        {
+            bool open;
+            out = print_element_start(out, node, flags, indent, open);
+            if (!open)
+                return out;
+            if (prints_children(node, flags) && cached_children(node, flags)) {
+                out = print_cached_children(out, node, flags, indent + 1);
+            } else if (prints_children(node, flags)) {
+                // Print all children with full indenting
+                if (indenting(flags))
+                    *out = Ch('\n'), ++out;
+                out = print_children(out, node, flags, indent + 1);
+                if (indenting(flags))
+                    out = fill_chars(out, indent, Ch('\t'));
+            } else {
+                out = print_element_value(out, node, flags);
+            }
+            return print_element_end(out, node);
+        }
+
         // Print declaration node
         template<class OutIt, class Ch>
         inline OutIt print_declaration_node(OutIt out, const optional_ptr<xml_node<Ch>> node, int flags, int indent)
         {
             // Print declaration start
-            if (!(flags & print_no_indenting))
+            if (indenting(flags))
                 out = fill_chars(out, indent, Ch('\t'));
             *out = Ch('<'), ++out;
             *out = Ch('?'), ++out;
@@ -299,7 +910,7 @@ namespace flxml
         inline OutIt print_comment_node(OutIt out, const optional_ptr<xml_node<Ch>> node, int flags, int indent)
         {
             assert(node->type() == node_type::node_comment);
-            if (!(flags & print_no_indenting))
+            if (indenting(flags))
                 out = fill_chars(out, indent, Ch('\t'));
             *out = Ch('<'), ++out;
             *out = Ch('!'), ++out;
@@ -317,7 +928,7 @@ namespace flxml
         inline OutIt print_doctype_node(OutIt out, const optional_ptr<xml_node<Ch>> node, int flags, int indent)
         {
             assert(node->type() == node_type::node_doctype);
-            if (!(flags & print_no_indenting))
+            if (indenting(flags))
                 out = fill_chars(out, indent, Ch('\t'));
             *out = Ch('<'), ++out;
             *out = Ch('!'), ++out;
@@ -339,7 +950,7 @@ namespace flxml
         inline OutIt print_pi_node(OutIt out, const optional_ptr<xml_node<Ch>> node, int flags, int indent)
         {
             assert(node->type() == node_type::node_pi);
-            if (!(flags & print_no_indenting))
+            if (indenting(flags))
                 out = fill_chars(out, indent, Ch('\t'));
             *out = Ch('<'), ++out;
             *out = Ch('?'), ++out;
@@ -356,13 +967,132 @@ namespace flxml
         inline OutIt print_literal_node(OutIt out, const optional_ptr<xml_node<Ch>> node, int flags, int indent)
         {
             assert(node->type() == node_type::node_literal);
-            if (!(flags & print_no_indenting))
+            if (indenting(flags))
                 out = fill_chars(out, indent, Ch('\t'));
             out = copy_chars(node->value(), out);
             return out;
         }
 
-        // Print node
+        // An element whose children are being printed, for print_child_range()
+        template<class Ch>
+        struct print_frame
+        {
+            optional_ptr<xml_node<Ch>> node;
+            optional_ptr<xml_node<Ch>> child;       // Next child to print, or null when done
+            int indent;                             // Indent of the children
+            bool mixed;                             // Whether the children are mixed content, when preserving formatting
+            std::basic_string_view<Ch> space;       // Whitespace of the last parsed child, when preserving formatting
+            std::basic_string_view<Ch> unit;        // Unit of indentation found in parsed whitespace, when preserving formatting
+        };
+
+        // Print children of the node from first up to but excluding last.
+        // Descendants are printed with an explicit stack rather than by recursion, so that depth is limited only by memory.
+        template<class OutIt, class Ch>
+        inline OutIt print_child_range(OutIt out, const optional_ptr<xml_node<Ch>> node, const optional_ptr<xml_node<Ch>> first, const optional_ptr<xml_node<Ch>> last, int flags, int indent)
+        {
+            const bool preserve = (flags & print_preserve_formatting) && !(flags & print_no_indenting);
+            std::vector<print_frame<Ch>> stack;
+            // New nodes are spaced like the sibling before them, if that was parsed.
+            auto space = preserve && first != node->first_node() ? preceding_space(node, first) : std::basic_string_view<Ch>();
+            stack.push_back({node, first, indent, preserve && mixed_content(node), space, indent_unit(space, indent)});
+            while (true)
+            {
+                auto & frame = stack.back();
+                auto child = frame.child;
+                auto end = stack.size() == 1 ? last : optional_ptr<xml_node<Ch>>();
+                if (!child || child == end) {
+                    if (stack.size() == 1)
+                        return out;
+                    // Finish the element whose children these were, as print_element_node() and print_node() would.
+                    auto element = frame.node;
+                    int element_indent = frame.indent - 1;
+                    auto unit = frame.unit;
+                    stack.pop_back();
+                    if (preserve)
+                        out = print_children_end_preserved(out, element, element_indent + 1, unit);
+                    if (indenting(flags))
+                        out = fill_chars(out, element_indent, Ch('\t'));
+                    out = print_element_end(out, element);
+                    if (indenting(flags))
+                        *out = Ch('\n'), ++out;
+                    continue;
+                }
+                auto const & source = child->source();
+                if (!source.empty() && (flags & (print_no_indenting | print_preserve_formatting))) {
+                    // Copy the longest run of unmodified siblings which were adjacent when parsed, taking the
+                    // whitespace before it too, so that spacing does not depend on which siblings were modified.
+                    const Ch *begin = source.data();
+                    if (preserve)
+                        begin = child->source_space().data();
+                    else if (sibling_space(child).data())
+                        begin = sibling_space(child).data();
+                    const Ch *run_end = source.data() + source.size();
+                    frame.space = child->source_space();
+                    for (child = child->next_sibling(); child && child != end && joined(run_end, child); child = child->next_sibling()) {
+                        run_end = child->source().data() + child->source().size();
+                        frame.space = child->source_space();
+                    }
+                    if (preserve && frame.unit.empty())
+                        frame.unit = indent_unit(frame.space, frame.indent);
+                    out = copy_chars(begin, run_end, out);
+                    frame.child = child;
+                    continue;
+                }
+                if (!preserve && (flags & print_no_indenting)) {
+                    out = copy_chars(sibling_space(child), out);
+                } else if (preserve) {
+                    if (child->source_space().data()) {
+                        frame.space = child->source_space();
+                        if (frame.unit.empty())
+                            frame.unit = indent_unit(frame.space, frame.indent);
+                        out = copy_chars(frame.space, out);
+                    } else if (frame.space.data()) {
+                        out = copy_chars(frame.space, out);
+                    } else if (!frame.mixed && (frame.node->type() != node_document || child != frame.node->first_node())) {
+                        out = print_line_preserved(out, frame.indent, frame.unit);
+                    }
+                }
+                frame.child = child->next_sibling();
+                if (child->type() != node_element) {
+                    out = print_node(out, child, flags, frame.indent);
+                    continue;
+                }
+                // Elements are printed here, descending into their children rather than calling print_node().
+                bool open;
+                out = print_element_start(out, child, flags, frame.indent, open);
+                if (open) {
+                    if (prints_children(child, flags) && !cached_children(child, flags)) {
+                        if (indenting(flags))
+                            *out = Ch('\n'), ++out;
+                        int child_indent = frame.indent + 1;
+                        // The frame reference is invalidated by the push.
+                        auto unit = frame.unit;
+                        stack.push_back({child, skip_children(out, child) ? optional_ptr<xml_node<Ch>>() : child->first_node(),
+                                         child_indent, preserve && mixed_content(child), {}, unit});
+                        continue;
+                    }
+                    if (prints_children(child, flags))
+                        out = print_cached_children(out, child, flags, frame.indent + 1);
+                    else
+                        out = print_element_value(out, child, flags);
+                    out = print_element_end(out, child);
+                }
+                if (indenting(flags))
+                    *out = Ch('\n'), ++out;
+            }
+        }
+
+        // Print children of the node
+        template<class OutIt, class Ch>
+        inline OutIt print_children(OutIt out, const optional_ptr<xml_node<Ch>> node, int flags, int indent)
+        {
+            if (!skip_children(out, node))
+                out = print_child_range(out, node, node->first_node(), optional_ptr<xml_node<Ch>>(), flags, indent);
+            if ((flags & print_preserve_formatting) && !(flags & print_no_indenting))
+                out = print_children_end_preserved(out, node, indent);
+            return out;
+        }
+
         // Print node
         template<class OutIt, class Ch>
         inline OutIt print_node(OutIt out, const optional_ptr<xml_node<Ch>> node, int flags, int indent)
@@ -421,13 +1151,470 @@ namespace flxml
             }
             
             // If indenting not disabled, add line break after node
-            if (!(flags & print_no_indenting))
+            if (indenting(flags))
                 *out = Ch('\n'), ++out;
 
             // Return modified iterator
             return out;
         }
         
+
+        ///////////////////////////////////////////////////////////////////////////
+        // Canonical XML
+
+        // Test whether the flags ask for canonical XML
+        inline bool canonical(int flags)
+        {
+            return flags & (print_c14n | print_c14n_exclusive);
+        }
+
+        // Write a string of ASCII characters
+        template<class OutIt, class Ch>
+        inline OutIt copy_ascii(const char *s, OutIt out, Ch)
+        {
+            while (*s)
+                *out = Ch(*s++), ++out;
+            return out;
+        }
+
+        // Copy text (or an attribute value) escaping as canonical XML requires, which differs from the references print() uses
+        template<class OutIt, class Ch>
+        inline OutIt copy_and_escape_canonical(std::basic_string_view<Ch> const & v, bool attribute, OutIt out)
+        {
+            const Ch *begin = v.data(), *end = v.data() + v.size();
+            for (const Ch *p = begin; p != end; ++p)
+            {
+                const char *ref = nullptr;
+                switch (*p)
+                {
+                case Ch('&'): ref = "&amp;"; break;
+                case Ch('<'): ref = "&lt;"; break;
+                case Ch('\r'): ref = "&#xD;"; break;
+                case Ch('>'): if (!attribute) ref = "&gt;"; break;
+                case Ch('"'): if (attribute) ref = "&quot;"; break;
+                case Ch('\t'): if (attribute) ref = "&#x9;"; break;
+                case Ch('\n'): if (attribute) ref = "&#xA;"; break;
+                default: break;
+                }
+                if (!ref)
+                    continue;
+                out = copy_chars(begin, p, out);
+                out = copy_ascii(ref, out, Ch());
+                begin = p + 1;
+            }
+            return copy_chars(begin, end, out);
+        }
+
+        // Prints a node as Canonical XML 1.0 or Exclusive XML Canonicalization 1.0.
+        // Namespace declarations are tracked as the tree is walked, both those in scope and those already rendered,
+        // so each element's declarations are decided from its own attributes without searching its ancestors.
+        template<class Ch>
+        class canonical_printer
+        {
+        public:
+            using view_type = std::basic_string_view<Ch>;
+
+            explicit canonical_printer(int flags) : m_flags(flags) {}
+
+            template<class OutIt>
+            OutIt print(OutIt out, const optional_ptr<xml_node<Ch>> node)
+            {
+                if (node->type() == node_document) {
+                    // Nodes outside the document element are separated from it by line breaks.
+                    bool after = false;
+                    for (auto child = node->first_node(); child; child = child->next_sibling()) {
+                        if (!printable(child))
+                            continue;
+                        if (after)
+                            *out = Ch('\n'), ++out;
+                        out = print_tree(out, child);
+                        if (child->type() == node_element)
+                            after = true;
+                        else if (!after)
+                            *out = Ch('\n'), ++out;
+                    }
+                    return out;
+                }
+                // The declarations of a subtree's ancestors are in scope for it, nearest last.
+                std::vector<optional_ptr<xml_node<Ch>>> ancestors;
+                for (auto parent = node->parent(); parent && parent->type() == node_element; parent = parent->parent())
+                    ancestors.push_back(parent);
+                for (auto it = ancestors.rbegin(); it != ancestors.rend(); ++it)
+                    declare(*it);
+                return print_tree(out, node);
+            }
+
+        private:
+            struct namespace_decl {
+                view_type prefix;
+                view_type uri;
+            };
+            struct frame {
+                optional_ptr<xml_node<Ch>> node;
+                optional_ptr<xml_node<Ch>> child;   // Next child to print
+                std::size_t scope;                  // Size of m_scope before the element's declarations
+                std::size_t rendered;               // Size of m_rendered before the element's declarations
+            };
+
+            bool printable(const optional_ptr<xml_node<Ch>> node) const
+            {
+                switch (node->type()) {
+                case node_declaration:
+                case node_doctype:
+                    return false;
+                case node_comment:
+                    return m_flags & print_c14n_comments;
+                default:
+                    return true;
+                }
+            }
+
+            static view_type prefix_of(view_type const & name)
+            {
+                auto colon = name.find(Ch(':'));
+                return colon == view_type::npos ? view_type() : name.substr(0, colon);
+            }
+
+            static view_type element_prefix(const optional_ptr<xml_node<Ch>> node)
+            {
+                return node->prefix().empty() ? prefix_of(node->name()) : node->prefix();
+            }
+
+            // Test whether an attribute is a namespace declaration, and if so which prefix it binds
+            static bool declaration(view_type const & name, view_type & prefix)
+            {
+                static constexpr Ch xmlns[] = {Ch('x'), Ch('m'), Ch('l'), Ch('n'), Ch('s'), Ch(0)};
+                if (!name.starts_with(xmlns))
+                    return false;
+                if (name.size() == 5) {
+                    prefix = {};
+                    return true;
+                }
+                if (name[5] != Ch(':'))
+                    return false;
+                prefix = name.substr(6);
+                return true;
+            }
+
+            static bool xml_prefix(view_type const & prefix)
+            {
+                return prefix.size() == 3 && prefix[0] == Ch('x') && prefix[1] == Ch('m') && prefix[2] == Ch('l');
+            }
+
+            static const namespace_decl *find(std::vector<namespace_decl> const & decls, view_type const & prefix)
+            {
+                for (auto it = decls.rbegin(); it != decls.rend(); ++it)
+                    if (it->prefix == prefix)
+                        return &*it;
+                return nullptr;
+            }
+
+            // The namespace bound to the prefix, or empty if none
+            view_type resolve(view_type const & prefix) const
+            {
+                if (xml_prefix(prefix))
+                    return view_type(s_xml_namespace);
+                auto decl = find(m_scope, prefix);
+                return decl ? decl->uri : view_type();
+            }
+
+            void declare(const optional_ptr<xml_node<Ch>> node)
+            {
+                view_type prefix;
+                for (auto attribute = node->first_attribute(); attribute; attribute = attribute->next_attribute())
+                    if (declaration(attribute->name(), prefix))
+                        m_scope.push_back({prefix, attribute->value()});
+            }
+
+            // Queue a declaration for rendering unless an output ancestor already rendered the same binding.
+            // An empty default namespace needs no declaration unless a non-empty one is in the output's scope.
+            void render(view_type const & prefix, view_type const & uri)
+            {
+                if (xml_prefix(prefix))
+                    return;
+                for (auto const & decl : m_decls)
+                    if (decl.prefix == prefix)
+                        return;
+                auto rendered = find(m_rendered, prefix);
+                if (rendered ? rendered->uri == uri : uri.empty())
+                    return;
+                m_decls.push_back({prefix, uri});
+            }
+
+            template<class OutIt>
+            OutIt print_start(OutIt out, const optional_ptr<xml_node<Ch>> node, std::size_t from)
+            {
+                view_type prefix;
+                m_attributes.clear();
+                for (auto attribute = node->first_attribute(); attribute; attribute = attribute->next_attribute())
+                    if (!declaration(attribute->name(), prefix))
+                        m_attributes.push_back(attribute.get());
+
+                // Choose the namespace declarations to render.
+                m_decls.clear();
+                if (m_flags & print_c14n_exclusive) {
+                    // Only those visibly utilized by the element or its attributes.
+                    auto element = element_prefix(node);
+                    if (!element.empty() && !xml_prefix(element) && !find(m_scope, element))
+                        throw element_xmlns_unbound("unbound element prefix");
+                    render(element, resolve(element));
+                    for (auto attribute : m_attributes) {
+                        auto p = prefix_of(attribute->name());
+                        if (p.empty())
+                            continue;
+                        if (!xml_prefix(p) && !find(m_scope, p))
+                            throw attr_xmlns_unbound("unbound attribute prefix");
+                        render(p, resolve(p));
+                    }
+                } else {
+                    // All in scope, nearest first so it shadows those further out. Below the apex of the output,
+                    // everything in scope was rendered or matched by an ancestor, so only the element's own need checking.
+                    for (std::size_t i = m_scope.size(); i-- > from;)
+                        render(m_scope[i].prefix, m_scope[i].uri);
+                }
+                std::sort(m_decls.begin(), m_decls.end(), [](namespace_decl const & a, namespace_decl const & b) {
+                    return a.prefix < b.prefix;
+                });
+                // Attributes are ordered by namespace, then local name; those in no namespace come first.
+                std::sort(m_attributes.begin(), m_attributes.end(), [this](xml_attribute<Ch> *a, xml_attribute<Ch> *b) {
+                    auto pa = prefix_of(a->name()), pb = prefix_of(b->name());
+                    auto na = pa.empty() ? view_type() : resolve(pa), nb = pb.empty() ? view_type() : resolve(pb);
+                    if (na != nb)
+                        return na < nb;
+                    return a->name().substr(pa.empty() ? 0 : pa.size() + 1) < b->name().substr(pb.empty() ? 0 : pb.size() + 1);
+                });
+
+                *out = Ch('<'), ++out;
+                out = print_qname(out, node);
+                for (auto const & decl : m_decls) {
+                    *out = Ch(' '), ++out;
+                    out = copy_ascii(decl.prefix.empty() ? "xmlns" : "xmlns:", out, Ch());
+                    out = copy_chars(decl.prefix, out);
+                    *out = Ch('='), ++out;
+                    *out = Ch('"'), ++out;
+                    out = copy_and_escape_canonical(decl.uri, true, out);
+                    *out = Ch('"'), ++out;
+                    m_rendered.push_back(decl);
+                }
+                for (auto attribute : m_attributes) {
+                    *out = Ch(' '), ++out;
+                    out = copy_chars(attribute->name(), out);
+                    *out = Ch('='), ++out;
+                    *out = Ch('"'), ++out;
+                    out = copy_and_escape_canonical(attribute->value(), true, out);
+                    *out = Ch('"'), ++out;
+                }
+                *out = Ch('>'), ++out;
+                return out;
+            }
+
+            template<class OutIt>
+            OutIt print_qname(OutIt out, const optional_ptr<xml_node<Ch>> node)
+            {
+                if (!node->prefix().empty()) {
+                    out = copy_chars(node->prefix(), out);
+                    *out = Ch(':'), ++out;
+                }
+                return copy_chars(node->name(), out);
+            }
+
+            template<class OutIt>
+            OutIt print_end(OutIt out, const optional_ptr<xml_node<Ch>> node)
+            {
+                *out = Ch('<'), ++out;
+                *out = Ch('/'), ++out;
+                out = print_qname(out, node);
+                *out = Ch('>'), ++out;
+                return out;
+            }
+
+            // Print a node other than an element or document
+            template<class OutIt>
+            OutIt print_leaf(OutIt out, const optional_ptr<xml_node<Ch>> node)
+            {
+                switch (node->type()) {
+                case node_data:
+                case node_cdata:
+                    // CDATA sections are replaced by their character content.
+                    return copy_and_escape_canonical(node->value(), false, out);
+                case node_comment:
+                    out = copy_ascii("<!--", out, Ch());
+                    out = copy_chars(node->value(), out);
+                    return copy_ascii("-->", out, Ch());
+                case node_pi:
+                    *out = Ch('<'), ++out;
+                    *out = Ch('?'), ++out;
+                    out = copy_chars(node->name(), out);
+                    if (!node->value().empty()) {
+                        *out = Ch(' '), ++out;
+                        out = copy_chars(node->value(), out);
+                    }
+                    *out = Ch('?'), ++out;
+                    *out = Ch('>'), ++out;
+                    return out;
+                case node_literal:
+                    return copy_chars(node->value(), out);
+                default:
+                    return out;
+                }
+            }
+
+            // Whitespace the parser kept only as the space before a node is character data, within an element.
+            template<class OutIt>
+            OutIt print_space(OutIt out, const optional_ptr<xml_node<Ch>> node)
+            {
+                if (node->type() != node_data && node->parent()->type() == node_element)
+                    out = copy_chars(node->source_space(), out);
+                return out;
+            }
+
+            // Print the node and its descendants, with an explicit stack rather than recursion
+            template<class OutIt>
+            OutIt print_tree(OutIt out, const optional_ptr<xml_node<Ch>> top)
+            {
+                if (top->type() != node_element)
+                    return print_leaf(out, top);
+                std::vector<frame> stack;
+                auto open = [&](const optional_ptr<xml_node<Ch>> node) {
+                    std::size_t scope = m_scope.size();
+                    std::size_t rendered = m_rendered.size();
+                    declare(node);
+                    out = print_start(out, node, stack.empty() ? 0 : scope);
+                    stack.push_back({node, node->first_node(), scope, rendered});
+                };
+                open(top);
+                while (!stack.empty()) {
+                    auto & f = stack.back();
+                    auto child = f.child;
+                    if (!child) {
+                        auto node = f.node;
+                        // An element built with a value and no children prints its value.
+                        if (!node->first_node())
+                            out = copy_and_escape_canonical(node->value(), false, out);
+                        else if (node->last_node()->type() != node_data && !node->contents().empty())
+                            out = copy_chars(trailing_space(node->contents()), out);
+                        out = print_end(out, node);
+                        m_scope.resize(f.scope);
+                        m_rendered.resize(f.rendered);
+                        stack.pop_back();
+                        continue;
+                    }
+                    f.child = child->next_sibling();
+                    out = print_space(out, child);
+                    if (!printable(child))
+                        continue;
+                    if (child->type() == node_element)
+                        open(child);
+                    else
+                        out = print_leaf(out, child);
+                }
+                return out;
+            }
+
+            static constexpr Ch s_xml_namespace[] = {
+                Ch('h'), Ch('t'), Ch('t'), Ch('p'), Ch(':'), Ch('/'), Ch('/'), Ch('w'), Ch('w'), Ch('w'), Ch('.'), Ch('w'), Ch('3'), Ch('.'),
+                Ch('o'), Ch('r'), Ch('g'), Ch('/'), Ch('X'), Ch('M'), Ch('L'), Ch('/'), Ch('1'), Ch('9'), Ch('9'), Ch('8'), Ch('/'),
+                Ch('n'), Ch('a'), Ch('m'), Ch('e'), Ch('s'), Ch('p'), Ch('a'), Ch('c'), Ch('e'), Ch(0)
+            };
+
+            int m_flags;
+            std::vector<namespace_decl> m_scope;        // Declarations in scope, outermost first
+            std::vector<namespace_decl> m_rendered;     // Declarations rendered by open output elements, outermost first
+            std::vector<namespace_decl> m_decls;        // Declarations to render on the current element
+            std::vector<xml_attribute<Ch> *> m_attributes;
+        };
+
+#ifndef FLXML_NO_THREADS
+        // Output iterator for the part of print_parallel() done on the calling thread.
+        // It prints into a buffer, but only records where the children of the split node belong.
+        template<class Ch>
+        class parallel_frame
+        {
+        public:
+            using iterator_category = std::output_iterator_tag;
+            using value_type = void;
+            using difference_type = std::ptrdiff_t;
+            using pointer = void;
+            using reference = void;
+
+            parallel_frame(print_buffer<Ch> & buffer, const xml_node<Ch> *split, std::size_t & offset)
+                : m_buffer(&buffer), m_split(split), m_offset(&offset) {}
+
+            parallel_frame & operator *() {
+                return *this;
+            }
+            parallel_frame & operator = (Ch ch) {
+                m_buffer->push_back(ch);
+                return *this;
+            }
+            parallel_frame & operator ++() {
+                return *this;
+            }
+            parallel_frame operator ++(int) {
+                return *this;
+            }
+
+            print_buffer<Ch> & buffer() const {
+                return *m_buffer;
+            }
+            bool split(const xml_node<Ch> *node) const {
+                return node == m_split;
+            }
+            void mark() const {
+                *m_offset = m_buffer->size();
+            }
+
+        private:
+            print_buffer<Ch> *m_buffer;
+            const xml_node<Ch> *m_split;
+            std::size_t *m_offset;
+        };
+
+        template<class Ch>
+        inline parallel_frame<Ch> copy_chars(const Ch *begin, const Ch *end, parallel_frame<Ch> out)
+        {
+            out.buffer().append(begin, end - begin);
+            return out;
+        }
+
+        template<class Ch>
+        inline parallel_frame<Ch> fill_chars(parallel_frame<Ch> out, int n, Ch ch)
+        {
+            if (n > 0) out.buffer().append(n, ch);
+            return out;
+        }
+
+        // Leave a mark in place of the split node's children
+        template<class Ch>
+        inline bool skip_children(parallel_frame<Ch> const & out, const optional_ptr<xml_node<Ch>> node)
+        {
+            if (!out.split(node.ptr_unsafe()))
+                return false;
+            out.mark();
+            return true;
+        }
+
+        // Decode any values the printer will read, so that printing allocates nothing from the document
+        template<class Ch>
+        inline void decode_values(const optional_ptr<xml_node<Ch>> node, int flags)
+        {
+            node->value();
+            for (auto attribute = node->first_attribute(); attribute; attribute = attribute->next_attribute())
+                if (attribute->source().empty() || indenting(flags))
+                    attribute->value();
+            // Clean contents are copied as they are, when not indenting.
+            if (node->type() == node_element && node->clean() && !indenting(flags))
+                return;
+            // Print caches are filled here too, since that also allocates.
+            if (node->type() == node_element && prints_children(node, flags) && cached_children(node, flags)) {
+                fill_print_cache(node, flags, 0);
+                return;
+            }
+            for (auto child = node->first_node(); child; child = child->next_sibling())
+                if (child->source().empty() || indenting(flags))
+                    decode_values(child, flags);
+        }
+#endif
     }
     //! \endcond
 
@@ -443,9 +1630,223 @@ namespace flxml
     inline OutIt print(OutIt out, const xml_node<Ch> &node, int flags = 0)
     {
         flxml::optional_ptr ptr(const_cast<xml_node<Ch> *>(&node));
+        if (internal::canonical(flags))
+            return internal::canonical_printer<Ch>(flags).print(out, ptr);
         return internal::print_node(out, ptr, flags, 0);
     }
 
+    //! Measures the XML print() would produce, without producing it.
+    //! Clean contents and names are counted by length; only text needing references is scanned.
+    //! The result can size a buffer for a single-allocation print().
+    //! \param node Node to be measured. Pass xml_document to measure entire document.
+    //! \param flags Flags controlling how XML would be printed.
+    //! \return Number of characters print() would write with the same flags.
+    template<class Ch>
+    inline std::size_t print_size(const xml_node<Ch> &node, int flags = 0)
+    {
+        return print(internal::print_counter(), node, flags).count();
+    }
+
+#ifndef FLXML_NO_THREADS
+
+    //! Fixed set of threads which print_parallel() hands work to, so that printing does not start threads each time.
+    //! print_parallel() uses a pool shared by the whole program unless given one; a pool of its own keeps printing from
+    //! competing with other work. The calling thread always takes part, and only waits for tasks that have started,
+    //! so printing from a pool's own thread cannot deadlock, however busy the pool is.
+    class print_pool
+    {
+    public:
+        //! Starts the threads.
+        //! \param threads Number of threads, or 0 for one fewer than the hardware concurrency, since the caller also prints.
+        explicit print_pool(unsigned threads = 0)
+        {
+            if (!threads) threads = std::max(2u, std::thread::hardware_concurrency()) - 1;
+            m_threads.reserve(threads);
+            for (unsigned t = 0; t != threads; ++t)
+                m_threads.emplace_back([this]() { run(); });
+        }
+
+        print_pool(print_pool const &) = delete;
+        print_pool & operator = (print_pool const &) = delete;
+
+        //! Finishes any queued tasks, then stops the threads.
+        ~print_pool()
+        {
+            {
+                std::lock_guard lock(m_mutex);
+                m_stop = true;
+            }
+            m_cv.notify_all();
+            for (auto & thread : m_threads)
+                thread.join();
+        }
+
+        //! Gets the number of threads.
+        //! \return Number of threads in the pool.
+        unsigned size() const
+        {
+            return static_cast<unsigned>(m_threads.size());
+        }
+
+        //! Queues a task to run on the first free thread.
+        //! \param task Task to run.
+        void submit(std::function<void()> task)
+        {
+            {
+                std::lock_guard lock(m_mutex);
+                m_tasks.push_back(std::move(task));
+            }
+            m_cv.notify_one();
+        }
+
+        //! Gets the pool print_parallel() uses when not given one, started on first use.
+        //! \return Pool shared by the whole program.
+        static print_pool & shared()
+        {
+            static print_pool pool;
+            return pool;
+        }
+
+    private:
+        void run()
+        {
+            while (true) {
+                std::function<void()> task;
+                {
+                    std::unique_lock lock(m_mutex);
+                    m_cv.wait(lock, [this]() { return m_stop || !m_tasks.empty(); });
+                    if (m_tasks.empty())
+                        return;
+                    task = std::move(m_tasks.front());
+                    m_tasks.pop_front();
+                }
+                task();
+            }
+        }
+
+        std::mutex m_mutex;                             // Guards the queue and m_stop
+        std::condition_variable m_cv;                   // Signalled when a task is queued, or the pool stops
+        std::deque<std::function<void()>> m_tasks;      // Tasks waiting for a thread
+        bool m_stop = false;                            // Whether the threads should finish
+        std::vector<std::thread> m_threads;
+    };
+
+    //! Prints XML to given output iterator, printing the children of the root element on several threads.
+    //! The children are divided into contiguous ranges, each printed into its own buffer by whichever thread is free,
+    //! and the buffers are then written out in document order; the output is identical to print().
+    //! Values still needing decoding are decoded first, on the calling thread, since decoding allocates from the document.
+    //! The document must not be modified until this returns.
+    //! The other threads come from pool, and are kept for the next call; see print_pool.
+    //! \param out Output iterator to print to.
+    //! \param node Node to be printed. Pass xml_document to print entire document.
+    //! \param flags Flags controlling how XML is printed.
+    //! \param pool Threads to print with, besides the calling thread.
+    //! \param threads Number of threads to print with, including the calling thread, or 0 to use the whole pool.
+    //! \return Output iterator pointing to position immediately after last character of printed text.
+    template<class OutIt, class Ch>
+    inline OutIt print_parallel(OutIt out, const xml_node<Ch> &node, int flags, print_pool & pool, unsigned threads = 0)
+    {
+        if (!threads || threads > pool.size() + 1) threads = pool.size() + 1;
+        optional_ptr<xml_node<Ch>> ptr(const_cast<xml_node<Ch> *>(&node));
+        // Split at the root element, whose children are the independent subtrees.
+        optional_ptr<xml_node<Ch>> split = ptr;
+        if (node.type() == node_document)
+            for (split = ptr->first_node(); split && split->type() != node_element; split = split->next_sibling());
+        std::size_t count = 0;
+        if (split && split->type() == node_element)
+            for (auto child = split->first_node(); child; child = child->next_sibling())
+                ++count;
+        // Anything the element printer would not hand to print_children goes the serial way.
+        bool copied = split && split->clean() && (flags & (print_no_indenting | print_preserve_formatting));
+        bool cached = split && internal::cached_children(split, flags);
+        if (threads < 2 || count < 2 || copied || cached || internal::canonical(flags))
+            return print(out, node, flags);
+
+        internal::decode_values(ptr, flags);
+
+        // Divide the children into more ranges than threads, so that a few large subtrees don't leave threads idle.
+        std::size_t ranges = std::min<std::size_t>(count, std::size_t(threads) * 4);
+        std::vector<optional_ptr<xml_node<Ch>>> bounds;
+        bounds.reserve(ranges + 1);
+        std::size_t index = 0;
+        for (auto child = split->first_node(); child; child = child->next_sibling(), ++index)
+            if (index * ranges / count >= bounds.size())
+                bounds.push_back(child);
+        bounds.push_back(optional_ptr<xml_node<Ch>>());
+
+        std::vector<print_buffer<Ch>> buffers(bounds.size() - 1);
+        std::atomic<std::size_t> next = 0;
+        auto work = [&]() {
+            for (std::size_t i = next++; i < buffers.size(); i = next++)
+                internal::print_child_range(buffers[i].inserter(), split, bounds[i], bounds[i + 1], flags, 1);
+        };
+        // Tasks which start once printing is over do nothing, so only those already working are waited for;
+        // their shared state outlives this call.
+        struct progress {
+            std::mutex mutex;
+            std::condition_variable done;
+            unsigned active = 0;
+            bool closed = false;
+            std::exception_ptr error;
+        };
+        auto state = std::make_shared<progress>();
+        for (unsigned t = 1; t < threads && t < buffers.size(); ++t)
+            pool.submit([state, &work]() {
+                {
+                    std::lock_guard lock(state->mutex);
+                    if (state->closed)
+                        return;
+                    ++state->active;
+                }
+                std::exception_ptr error;
+                try {
+                    work();
+                } catch (...) {
+                    error = std::current_exception();
+                }
+                std::lock_guard lock(state->mutex);
+                if (error)
+                    state->error = error;
+                if (--state->active == 0)
+                    state->done.notify_all();
+            });
+
+        // Print everything around the split element's children while the workers run, then help them.
+        print_buffer<Ch> frame;
+        std::size_t offset = 0;
+        internal::print_node(internal::parallel_frame<Ch>(frame, split.ptr_unsafe(), offset), ptr, flags, 0);
+        work();
+        {
+            std::unique_lock lock(state->mutex);
+            state->closed = true;
+            state->done.wait(lock, [&state]() { return state->active == 0; });
+            if (state->error)
+                std::rethrow_exception(state->error);
+        }
+
+        out = internal::copy_chars(frame.data(), frame.data() + offset, out);
+        for (auto const & buffer : buffers)
+            out = internal::copy_chars(buffer.data(), buffer.data() + buffer.size(), out);
+        return internal::copy_chars(frame.data() + offset, frame.data() + frame.size(), out);
+    }
+
+    //! Prints XML to given output iterator, printing the children of the root element on several threads
+    //! taken from print_pool::shared(), as the overload above does.
+    //! \param out Output iterator to print to.
+    //! \param node Node to be printed. Pass xml_document to print entire document.
+    //! \param flags Flags controlling how XML is printed.
+    //! \param threads Number of threads to print with, including the calling thread, or 0 to use the whole pool.
+    //! \return Output iterator pointing to position immediately after last character of printed text.
+    template<class OutIt, class Ch>
+    inline OutIt print_parallel(OutIt out, const xml_node<Ch> &node, int flags = 0, unsigned threads = 0)
+    {
+        if (threads == 1)
+            return print(out, node, flags);
+        return print_parallel(out, node, flags, print_pool::shared(), threads);
+    }
+
+#endif
+
 #ifndef RAPIDXML_NO_STREAMS
 
     //! Prints XML to given output stream.
@@ -456,7 +1857,10 @@ namespace flxml
     template<class Ch> 
     inline std::basic_ostream<Ch> &print(std::basic_ostream<Ch> &out, const xml_node<Ch> &node, int flags = 0)
     {
-        print(std::ostream_iterator<Ch>(out), node, flags);
+        // Printing a character at a time through an ostream_iterator is slow; buffer and write once instead.
+        print_buffer<Ch> buffer;
+        print(buffer.inserter(), node, flags);
+        out.write(buffer.data(), buffer.size());
         return out;
     }
 
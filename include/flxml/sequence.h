@@ -0,0 +1,353 @@
+#ifndef FLXML_SEQUENCE_HPP_INCLUDED
+#define FLXML_SEQUENCE_HPP_INCLUDED
+
+//! \file sequence.h This file contains a range over a buffer of concatenated documents or stanzas,
+//! and a scanner finding where each one ends as bytes arrive.
+
+#include <flxml.h>
+#include <iterator>
+#include <string_view>
+#include <algorithm>
+#include <cstring>
+
+namespace flxml
+{
+
+    //! Parses a buffer holding many concatenated documents or stanzas, one top-level element at a time.
+    //! Each step parses the next element, and anything before it, into the same document with parse_parse_one,
+    //! so there is no per-item setup. By default the document's memory pool is cleared before each item,
+    //! so memory stays bounded however many items there are; without this, earlier nodes stay valid,
+    //! though detached, until the sequence is destroyed.
+    //! Whitespace between items is skipped. A parse error is thrown from the step that meets it.
+    //! \param Flags Parse flags to use for every item; parse_parse_one is added.
+    //! \param Ch Character type to use.
+    template<int Flags = 0, typename Ch = char>
+    class document_sequence
+    {
+    public:
+        using view_type = std::basic_string_view<Ch>;
+
+        //! Input iterator yielding the document holding each item in turn.
+        class iterator
+        {
+        public:
+            using value_type = xml_document<Ch>;
+            using reference = xml_document<Ch> &;
+            using pointer = xml_document<Ch> *;
+            using iterator_category = std::input_iterator_tag;
+            using difference_type = std::ptrdiff_t;
+
+            iterator() = default;
+            explicit iterator(document_sequence * sequence) : m_sequence(sequence) {}
+
+            reference operator *() const
+            {
+                return m_sequence->m_document;
+            }
+
+            pointer operator->() const
+            {
+                return &m_sequence->m_document;
+            }
+
+            iterator & operator++()
+            {
+                m_sequence->next();
+                return *this;
+            }
+
+            void operator++(int)
+            {
+                ++*this;
+            }
+
+            bool operator == (std::default_sentinel_t) const
+            {
+                return !m_sequence || m_sequence->m_item.data() == nullptr;
+            }
+
+        private:
+            document_sequence * m_sequence = nullptr;
+        };
+
+        //! Constructs a sequence over the given text, which must outlive any use of the items.
+        //! \param text Concatenated documents or stanzas.
+        //! \param reset True to clear the memory pool before each item.
+        //! \param parent Document whose root element supplies namespace bindings, as for xml_document::parse().
+        explicit document_sequence(view_type const & text, bool reset = true, xml_document<Ch> * parent = nullptr)
+            : m_remaining(text), m_reset(reset), m_parent(parent)
+        {
+        }
+
+        document_sequence(document_sequence const &) = delete;
+        document_sequence & operator = (document_sequence const &) = delete;
+
+        //! Parses the first item, if not already parsed, and returns an iterator to it.
+        iterator begin()
+        {
+            if (!m_started) {
+                m_started = true;
+                next();
+            }
+            return iterator(this);
+        }
+
+        std::default_sentinel_t end() const
+        {
+            return {};
+        }
+
+        //! Gets the document holding the current item.
+        xml_document<Ch> & document()
+        {
+            return m_document;
+        }
+
+        //! Gets the text of the current item, from the first character after any whitespace to the end of its element.
+        //! \return Text of the current item, or empty when the sequence is exhausted.
+        view_type const & item() const
+        {
+            return m_item;
+        }
+
+        //! Gets the text after the current item, not yet parsed.
+        view_type const & remaining() const
+        {
+            return m_remaining;
+        }
+
+    private:
+        void next()
+        {
+            auto start = m_remaining.find_first_not_of(s_whitespace);
+            if (start == view_type::npos) {
+                m_item = {};
+                m_remaining = {};
+                return;
+            }
+            view_type rest = m_remaining.substr(start);
+            if (m_reset)
+                m_document.clear();
+            auto end = m_document.template parse<Flags | parse_parse_one>(rest, m_parent);
+            auto used = static_cast<std::size_t>(end - buffer_ptr<view_type>(rest));
+            m_item = rest.substr(0, used);
+            m_remaining = rest.substr(used);
+        }
+
+        static constexpr Ch s_whitespace[] = {Ch(' '), Ch('\t'), Ch('\r'), Ch('\n'), Ch(0)};
+
+        xml_document<Ch> m_document;
+        view_type m_remaining;
+        view_type m_item;
+        bool m_reset;
+        bool m_started = false;
+        xml_document<Ch> * m_parent;
+    };
+
+    //! Finds where stanzas end in arriving text, without parsing them into nodes.
+    //! Only tag depth, quoted attribute values, comments, CDATA sections, processing instructions and declarations
+    //! are tracked, so a stanza which is not well-formed is only found when the full parse rejects it.
+    //! Text is fed in pieces of any size; each call stops just after a boundary, which is the end of any tag,
+    //! comment, processing instruction or declaration leaving no more than the stanza level of elements open.
+    //! For an XMPP stream, with the default level of 1, that is the end of the stream header, of each stanza,
+    //! and of the stream. Whitespace between stanzas becomes part of the next one.
+    //! \param Ch Character type to use.
+    template<typename Ch = char>
+    class stanza_scanner
+    {
+    public:
+        using view_type = std::basic_string_view<Ch>;
+
+        //! Constructs a scanner.
+        //! \param level Number of open elements, such as the stream element, that stanzas are within.
+        explicit stanza_scanner(std::size_t level = 1) : m_level(level) {}
+
+        //! Scans text, up to and including the next boundary.
+        //! \param text Text following everything scanned so far.
+        //! \return Number of characters scanned; fewer than given only if a boundary was found.
+        std::size_t feed(view_type const & text)
+        {
+            m_boundary = false;
+            const Ch *p = text.data();
+            const Ch *end = p + text.size();
+            while (p != end && !m_boundary) {
+                switch (m_state) {
+                case state::content:
+                    // Most of the text is content, so find the next tag in bulk.
+                    p = find(p, end, Ch('<'));
+                    if (p != end) {
+                        m_state = state::open;
+                        ++p;
+                    }
+                    break;
+                case state::open:
+                    m_last = Ch(0);
+                    switch (*p) {
+                    case Ch('/'):
+                        m_state = state::end_tag;
+                        break;
+                    case Ch('?'):
+                        m_state = state::pi;
+                        break;
+                    case Ch('!'):
+                        m_state = state::bang;
+                        break;
+                    default:
+                        m_state = state::start_tag;
+                        m_last = *p;
+                    }
+                    ++p;
+                    break;
+                case state::start_tag:
+                case state::end_tag:
+                    for (; p != end; ++p) {
+                        if (*p == Ch('"') || *p == Ch('\'')) {
+                            m_quote = *p++;
+                            m_resume = m_state;
+                            m_state = state::quoted;
+                            break;
+                        }
+                        if (*p == Ch('>')) {
+                            if (m_state == state::end_tag) {
+                                if (m_depth == 0) throw parse_error("unexpected end tag", const_cast<Ch *>(p));
+                                --m_depth;
+                            } else if (m_last != Ch('/')) {
+                                ++m_depth;
+                            }
+                            ++p;
+                            close();
+                            break;
+                        }
+                        m_last = *p;
+                    }
+                    break;
+                case state::quoted:
+                    p = find(p, end, m_quote);
+                    if (p != end) {
+                        ++p;
+                        m_last = m_quote;
+                        m_state = m_resume;
+                    }
+                    break;
+                case state::bang:
+                    // Distinguish <!-- and <![CDATA[ from declarations, one character at a time.
+                    if (m_match == 0 && (*p == Ch('-') || *p == Ch('['))) {
+                        m_terminator = *p == Ch('-') ? Ch('-') : Ch(']');
+                        m_match = 1;
+                    } else if (m_match != 0 && m_terminator == Ch('-') && *p == Ch('-')) {
+                        m_match = 0;
+                        m_state = state::section;
+                    } else if (m_match != 0 && m_terminator == Ch(']') && *p == Ch(s_cdata[m_match])) {
+                        if (++m_match == sizeof(s_cdata) - 1) {
+                            m_match = 0;
+                            m_state = state::section;
+                        }
+                    } else {
+                        m_match = 0;
+                        m_terminator = Ch(0);
+                        m_state = state::declaration;
+                        continue;
+                    }
+                    ++p;
+                    break;
+                case state::section:
+                    // Comments end with -->, and CDATA with ]]>; count the run of terminators before a >.
+                    if (m_match == 0) {
+                        p = find(p, end, m_terminator);
+                        if (p == end) break;
+                    }
+                    if (*p == m_terminator) {
+                        ++m_match;
+                    } else if (*p == Ch('>') && m_match >= 2) {
+                        m_match = 0;
+                        m_terminator = Ch(0);
+                        ++p;
+                        close();
+                        break;
+                    } else {
+                        m_match = 0;
+                    }
+                    ++p;
+                    break;
+                case state::pi:
+                    if (m_match == 0) {
+                        p = find(p, end, Ch('?'));
+                        if (p == end) break;
+                    }
+                    if (*p == Ch('>') && m_match != 0) {
+                        m_match = 0;
+                        ++p;
+                        close();
+                        break;
+                    }
+                    m_match = *p == Ch('?');
+                    ++p;
+                    break;
+                case state::declaration:
+                    // A DOCTYPE may hold an internal subset in brackets, with > inside.
+                    if (*p == Ch('[')) {
+                        ++m_match;
+                    } else if (*p == Ch(']') && m_match != 0) {
+                        --m_match;
+                    } else if (*p == Ch('>') && m_match == 0) {
+                        ++p;
+                        close();
+                        break;
+                    }
+                    ++p;
+                    break;
+                }
+            }
+            return static_cast<std::size_t>(p - text.data());
+        }
+
+        //! Tests whether the last call to feed() stopped at a boundary.
+        bool boundary() const
+        {
+            return m_boundary;
+        }
+
+        //! Gets the number of elements open.
+        std::size_t depth() const
+        {
+            return m_depth;
+        }
+
+    private:
+        enum class state {
+            content, open, start_tag, end_tag, quoted, bang, section, pi, declaration
+        };
+
+        static constexpr char s_cdata[] = "[CDATA[";
+
+        static const Ch *find(const Ch *p, const Ch *end, Ch c)
+        {
+            if constexpr (sizeof(Ch) == 1) {
+                // memchr is vectorised by the C library.
+                auto found = std::memchr(p, static_cast<unsigned char>(c), static_cast<std::size_t>(end - p));
+                return found ? static_cast<const Ch *>(found) : end;
+            } else {
+                return std::find(p, end, c);
+            }
+        }
+
+        void close()
+        {
+            m_state = state::content;
+            m_boundary = m_depth <= m_level;
+        }
+
+        std::size_t m_level;
+        std::size_t m_depth = 0;
+        state m_state = state::content;
+        state m_resume = state::content;
+        std::size_t m_match = 0;        // Characters matched towards a terminator, or open brackets in a declaration
+        Ch m_terminator = Ch(0);        // Repeated character ending a comment or CDATA section
+        Ch m_quote = Ch(0);
+        Ch m_last = Ch(0);              // Last character in a tag, outside quotes
+        bool m_boundary = false;
+    };
+
+}
+
+#endif
@@ -12,6 +12,45 @@
 #include <string>
 #include <fstream>
 #include <stdexcept>
+#include <string_view>
+#include <utility>
+#include <algorithm>
+#include <initializer_list>
+#include <cstdint>
+#include <cstring>
+#include <array>
+#include <memory>
+#include <span>
+
+// Offer memory-mapped files where the platform has mmap()
+#if __has_include(<sys/mman.h>) && __has_include(<sys/stat.h>) && __has_include(<fcntl.h>) && __has_include(<unistd.h>)
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+    #define FLXML_HAS_MMAP
+#endif
+
+// Use SSE2 to transcode runs of ASCII, unless disabled
+#if defined(__SSE2__) && !defined(FLXML_NO_SIMD)
+    #include <emmintrin.h>
+#endif
+
+// Only include threads if not disabled
+#ifndef FLXML_NO_THREADS
+    #include <condition_variable>
+    #include <exception>
+    #include <mutex>
+    #include <thread>
+#endif
+
+// Decompression needs linking with zlib or libzstd, so each is only offered when asked for
+#ifdef FLXML_ZLIB
+    #include <zlib.h>
+#endif
+#ifdef FLXML_ZSTD
+    #include <zstd.h>
+#endif
 
 namespace flxml
 {
@@ -87,6 +126,658 @@ namespace flxml
 
     };
 
+#ifdef FLXML_HAS_MMAP
+    //! Represents a file mapped read-only into memory.
+    //! Nothing is copied: pages are read on demand through the page cache, and the mapping is advised for
+    //! sequential access with read-ahead. The data is not NUL-terminated, so parse view(), which takes the
+    //! bounded parse path. The document refers into the mapping, so it must outlive the document.
+    template<class Ch = char>
+    class mapped_file
+    {
+    public:
+        using view_type = std::basic_string_view<Ch>;
+
+        //! Maps a file into memory. It will be unmapped by the destructor.
+        //! \param filename Filename to map.
+        explicit mapped_file(const char *filename)
+        {
+            int fd = ::open(filename, O_RDONLY | O_CLOEXEC);
+            if (fd < 0)
+                throw std::runtime_error(std::string("cannot open file ") + filename);
+            struct stat st;
+            if (::fstat(fd, &st) != 0) {
+                ::close(fd);
+                throw std::runtime_error(std::string("cannot stat file ") + filename);
+            }
+            m_size = static_cast<std::size_t>(st.st_size) / sizeof(Ch);
+            if (m_size != 0) {
+                void *data = ::mmap(nullptr, m_size * sizeof(Ch), PROT_READ, MAP_PRIVATE, fd, 0);
+                if (data == MAP_FAILED) {
+                    ::close(fd);
+                    throw std::runtime_error(std::string("cannot map file ") + filename);
+                }
+                // Advice is only a hint, so failures are ignored.
+                ::madvise(data, m_size * sizeof(Ch), MADV_SEQUENTIAL);
+                ::madvise(data, m_size * sizeof(Ch), MADV_WILLNEED);
+                m_data = static_cast<const Ch *>(data);
+            }
+            // The mapping holds its own reference to the file.
+            ::close(fd);
+        }
+
+        mapped_file(mapped_file && other) noexcept
+            : m_data(std::exchange(other.m_data, nullptr)), m_size(std::exchange(other.m_size, 0))
+        {
+        }
+        mapped_file & operator = (mapped_file && other) noexcept
+        {
+            std::swap(m_data, other.m_data);
+            std::swap(m_size, other.m_size);
+            return *this;
+        }
+        mapped_file(mapped_file const &) = delete;
+        mapped_file & operator = (mapped_file const &) = delete;
+
+        ~mapped_file()
+        {
+            if (m_data)
+                ::munmap(const_cast<Ch *>(m_data), m_size * sizeof(Ch));
+        }
+
+        //! Gets file data.
+        //! \return Pointer to data of file, which is not NUL-terminated.
+        const Ch *data() const
+        {
+            return m_data;
+        }
+
+        //! Gets file data size.
+        //! \return Size of file data, in characters.
+        std::size_t size() const
+        {
+            return m_size;
+        }
+
+        //! Gets file data, for parsing.
+        //! \return View of the whole file.
+        view_type view() const
+        {
+            return {m_data, m_size};
+        }
+
+    private:
+
+        const Ch *m_data = nullptr;   // Mapped data, or null if empty
+        std::size_t m_size = 0;       // Size of mapped data, in characters
+
+    };
+#endif
+
+#if defined(FLXML_ZLIB) || defined(FLXML_ZSTD)
+    //! Represents text read from a compressed file, decompressed one buffer at a time as the parser reaches it.
+    //! Neither the compressed input nor the decompressed text is gathered into one buffer: the text is held in
+    //! a chain of buffers, which the document refers into, and parsing starts as soon as the first is filled.
+    //! Buffers are never moved or copied, so the text costs no more memory than its own size, plus whatever of
+    //! the last buffer is unused. Decompression can run on a second thread, overlapping with parsing; otherwise
+    //! it runs on the parsing thread, a buffer at a time.
+    //! gzip and zlib input need FLXML_ZLIB, and zstd input needs FLXML_ZSTD; anything else is read as it is.
+    //! Parse text() with xml_document::parse(); this must outlive the document.
+    template<class Ch = char>
+    class decompressed_file : private segment_feed<Ch>
+    {
+    public:
+        using view_type = std::basic_string_view<Ch>;
+
+        //! Size of each chunk of compressed input read, and of the first buffers of decompressed text.
+        //! Later buffers double in size every four, so that a fixed table of them covers any input.
+        static constexpr std::size_t chunk_size = 64 * 1024;
+
+        //! Opens a file to decompress.
+        //! \param filename Filename to load.
+        //! \param background True to decompress on a second thread while the text is parsed.
+        explicit decompressed_file(const char *filename, bool background = false)
+            : m_file(filename, std::ios::binary), m_stream(m_file)
+        {
+            if (!m_file)
+                throw std::runtime_error(std::string("cannot open file ") + filename);
+            start(background);
+        }
+
+        //! Decompresses a stream.
+        //! \param stream Stream to load from, which must outlive this.
+        //! \param background True to decompress on a second thread while the text is parsed.
+        explicit decompressed_file(std::istream &stream, bool background = false)
+            : m_stream(stream)
+        {
+            start(background);
+        }
+
+        decompressed_file(decompressed_file const &) = delete;
+        decompressed_file & operator = (decompressed_file const &) = delete;
+
+        ~decompressed_file()
+        {
+#ifndef FLXML_NO_THREADS
+            if (m_thread.joinable()) {
+                {
+                    std::lock_guard lock(m_mutex);
+                    m_stop = true;
+                }
+                m_thread.join();
+            }
+#endif
+#ifdef FLXML_ZLIB
+            if (m_format == format::gzip)
+                inflateEnd(&m_zs);
+#endif
+#ifdef FLXML_ZSTD
+            if (m_zds)
+                ZSTD_freeDStream(m_zds);
+#endif
+        }
+
+        //! Gets the start of the text, for parsing; the rest is decompressed as the parser reaches it.
+        //! \return Position of the start of the text.
+        segmented_ptr<Ch> text()
+        {
+            auto last = more(nullptr);
+            return segmented_ptr<Ch>(std::span<const view_type>(m_segments.data(), last + 1), this);
+        }
+
+        //! Gets the text decompressed so far, such as once it has all been parsed.
+        //! \return Buffers of text, in order.
+        std::span<const view_type> segments()
+        {
+#ifndef FLXML_NO_THREADS
+            std::lock_guard lock(m_mutex);
+#endif
+            return {m_segments.data(), m_count};
+        }
+
+    private:
+
+        enum class format { plain, gzip, zstd };
+
+        void start(bool background)
+        {
+            m_chunk.resize(chunk_size);
+            m_avail = read(m_stream, m_chunk.data(), m_chunk.size());
+            auto magic = [this](std::initializer_list<unsigned char> bytes) {
+                if (m_avail < bytes.size()) return false;
+                auto p = m_chunk.data();
+                for (auto b : bytes)
+                    if (static_cast<unsigned char>(*p++) != b) return false;
+                return true;
+            };
+            if (false) {
+#ifdef FLXML_ZLIB
+            } else if (magic({0x1f, 0x8b})) {
+                // Window bits of 15 + 32 accept both gzip and zlib headers.
+                if (inflateInit2(&m_zs, 15 + 32) != Z_OK)
+                    throw std::runtime_error("cannot initialise zlib");
+                m_format = format::gzip;
+                m_zs.next_in = reinterpret_cast<Bytef *>(m_chunk.data());
+                m_zs.avail_in = static_cast<uInt>(m_avail);
+#endif
+#ifdef FLXML_ZSTD
+            } else if (magic({0x28, 0xb5, 0x2f, 0xfd})) {
+                m_zds = ZSTD_createDStream();
+                if (!m_zds)
+                    throw std::runtime_error("cannot initialise zstd");
+                ZSTD_initDStream(m_zds);
+                m_format = format::zstd;
+                m_in = {m_chunk.data(), m_avail, 0};
+#endif
+            }
+#ifndef FLXML_NO_THREADS
+            if (background)
+                m_thread = std::thread([this]() { produce(); });
+#else
+            (void)background;
+#endif
+        }
+
+        static std::size_t read(std::istream &stream, char *buf, std::size_t size)
+        {
+            stream.read(buf, static_cast<std::streamsize>(size));
+            if (stream.bad())
+                throw std::runtime_error("error reading stream");
+            return static_cast<std::size_t>(stream.gcount());
+        }
+
+        // Waits for the segment after last, or the end of the input, decompressing it here unless on another thread.
+        const view_type * more(const view_type * last) override
+        {
+            std::size_t next = last ? static_cast<std::size_t>(last - m_segments.data()) + 1 : 0;
+#ifndef FLXML_NO_THREADS
+            if (m_thread.joinable()) {
+                std::unique_lock lock(m_mutex);
+                m_cv.wait(lock, [this, next]() { return m_count > next || m_done; });
+                if (m_count <= next && m_error)
+                    std::rethrow_exception(m_error);
+                return m_segments.data() + m_count - 1;
+            }
+#endif
+            while (m_count <= next && !m_done)
+                fill();
+            return m_segments.data() + m_count - 1;
+        }
+
+#ifndef FLXML_NO_THREADS
+        void produce()
+        {
+            try {
+                while (fill()) {
+                    std::lock_guard lock(m_mutex);
+                    if (m_stop)
+                        return;
+                }
+            } catch (...) {
+                std::lock_guard lock(m_mutex);
+                m_error = std::current_exception();
+                m_done = true;
+                m_cv.notify_all();
+            }
+        }
+#endif
+
+        // Decompresses the next buffer of text and adds it to the table; returns false once the input has ended.
+        bool fill()
+        {
+            std::size_t index = m_buffers.size();
+            if (index == m_segments.size())
+                throw std::runtime_error("decompressed data too large");
+            std::size_t size = chunk_size << (index / 4);
+            auto buffer = std::make_unique_for_overwrite<char[]>(size);
+            std::size_t used = 0;
+            while (used != size) {
+                std::size_t n = decode(buffer.get() + used, size - used);
+                if (n == 0)
+                    break;
+                used += n;
+            }
+            bool full = used == size;
+            if (used % sizeof(Ch))
+                throw std::runtime_error("decompressed data is not a whole number of characters");
+            view_type text{reinterpret_cast<const Ch *>(buffer.get()), used / sizeof(Ch)};
+#ifndef FLXML_NO_THREADS
+            std::lock_guard lock(m_mutex);
+#endif
+            m_buffers.push_back(std::move(buffer));
+            m_segments[index] = text;
+            m_count = index + 1;
+            m_done = !full;
+#ifndef FLXML_NO_THREADS
+            m_cv.notify_all();
+#endif
+            return full;
+        }
+
+        // Reads the next chunk of input, once the last is used; returns false at the end of the input.
+        bool refill()
+        {
+            if (m_eof)
+                return false;
+            m_avail = read(m_stream, m_chunk.data(), m_chunk.size());
+            m_eof = m_avail == 0;
+            return !m_eof;
+        }
+
+        // Decompresses up to size bytes of text into out, returning how many; none means the input has ended.
+        std::size_t decode(char *out, std::size_t size)
+        {
+#ifdef FLXML_ZLIB
+            if (m_format == format::gzip)
+                return inflate_gzip(out, size);
+#endif
+#ifdef FLXML_ZSTD
+            if (m_format == format::zstd)
+                return decompress_zstd(out, size);
+#endif
+            if (m_plain == m_avail) {
+                if (!refill())
+                    return 0;
+                m_plain = 0;
+            }
+            std::size_t n = std::min(size, m_avail - m_plain);
+            std::memcpy(out, m_chunk.data() + m_plain, n);
+            m_plain += n;
+            return n;
+        }
+
+#ifdef FLXML_ZLIB
+        std::size_t inflate_gzip(char *out, std::size_t size)
+        {
+            m_zs.next_out = reinterpret_cast<Bytef *>(out);
+            m_zs.avail_out = static_cast<uInt>(size);
+            while (m_zs.avail_out != 0) {
+                if (m_zs.avail_in == 0 && refill()) {
+                    m_zs.next_in = reinterpret_cast<Bytef *>(m_chunk.data());
+                    m_zs.avail_in = static_cast<uInt>(m_avail);
+                }
+                if (m_ret == Z_STREAM_END) {
+                    if (m_zs.avail_in == 0)
+                        break;
+                    // Concatenated gzip members decompress as one.
+                    inflateReset(&m_zs);
+                }
+                auto before = m_zs.avail_out;
+                m_ret = ::inflate(&m_zs, Z_NO_FLUSH);
+                if (m_ret != Z_OK && m_ret != Z_STREAM_END && m_ret != Z_BUF_ERROR)
+                    throw std::runtime_error("corrupt compressed data");
+                // Once the input has ended, pending output is still flushed, but anything else is truncation.
+                if (m_eof && m_ret != Z_STREAM_END && m_zs.avail_out == before)
+                    throw std::runtime_error("truncated compressed data");
+            }
+            return size - m_zs.avail_out;
+        }
+#endif
+
+#ifdef FLXML_ZSTD
+        std::size_t decompress_zstd(char *out, std::size_t size)
+        {
+            ZSTD_outBuffer buf{out, size, 0};
+            while (buf.pos != buf.size) {
+                if (m_in.pos == m_in.size && refill())
+                    m_in = {m_chunk.data(), m_avail, 0};
+                auto before = buf.pos;
+                auto consumed = m_in.pos;
+                auto hint = ZSTD_decompressStream(m_zds, &buf, &m_in);
+                if (ZSTD_isError(hint))
+                    throw std::runtime_error("corrupt compressed data");
+                // A call that does nothing asks for the next frame header, so only progress says where the last frame stands.
+                if (buf.pos != before || m_in.pos != consumed)
+                    m_hint = hint;
+                // Once the input has ended, pending output is still flushed; a non-zero hint then means the last frame is incomplete.
+                if (m_eof && buf.pos == before) {
+                    if (m_hint != 0)
+                        throw std::runtime_error("truncated compressed data");
+                    break;
+                }
+            }
+            return buf.pos;
+        }
+#endif
+
+        std::ifstream m_file;                               // File opened by name, if any
+        std::istream &m_stream;                             // Compressed input
+        std::vector<char> m_chunk;                          // Current chunk of compressed input
+        std::size_t m_avail = 0;                            // Bytes in the current chunk
+        std::size_t m_plain = 0;                            // Bytes of the current chunk used, for uncompressed input
+        bool m_eof = false;                                 // Whether the input has ended
+        format m_format = format::plain;
+#ifdef FLXML_ZLIB
+        z_stream m_zs{};
+        int m_ret = Z_OK;                                   // Last result from inflate()
+#endif
+#ifdef FLXML_ZSTD
+        ZSTD_DStream *m_zds = nullptr;
+        ZSTD_inBuffer m_in{};
+        std::size_t m_hint = 0;                             // Last result from ZSTD_decompressStream()
+#endif
+        std::vector<std::unique_ptr<char[]>> m_buffers;     // Decompressed text
+        std::array<view_type, 64> m_segments{};             // Views of the buffers, for parsing; never moved
+        std::size_t m_count = 0;                            // Number of buffers filled
+        bool m_done = false;                                // Whether the last buffer is filled
+#ifndef FLXML_NO_THREADS
+        std::mutex m_mutex;                                 // Guards the table and the state below, when decompressing on a thread
+        std::condition_variable m_cv;                       // Signalled as each buffer is filled
+        std::exception_ptr m_error;                         // Failure on the decompressing thread, if any
+        bool m_stop = false;                                // Whether the decompressing thread should stop
+        std::thread m_thread;                               // Decompressing thread, if any
+#endif
+    };
+#endif
+
+    //! Encodings recognised in input by utf8_input.
+    enum class input_encoding
+    {
+        utf8,       //!< UTF-8, or US-ASCII.
+        utf16le,
+        utf16be,
+        utf32le,
+        utf32be,
+        latin1      //!< ISO-8859-1, as declared by the XML declaration.
+    };
+
+    //! \cond internal
+    namespace internal
+    {
+        // Find the encoding named by an XML declaration in an ASCII-compatible encoding, or empty if none.
+        inline std::string_view declared_encoding(std::string_view const & text)
+        {
+            if (!text.starts_with("<?xml")) return {};
+            auto end = text.find("?>");
+            auto decl = text.substr(0, end);
+            auto pos = decl.find("encoding");
+            if (pos == std::string_view::npos) return {};
+            pos = decl.find_first_not_of(" \t\r\n", pos + 8);
+            if (pos == std::string_view::npos || decl[pos] != '=') return {};
+            pos = decl.find_first_not_of(" \t\r\n", pos + 1);
+            if (pos == std::string_view::npos || (decl[pos] != '"' && decl[pos] != '\'')) return {};
+            auto close = decl.find(decl[pos], pos + 1);
+            if (close == std::string_view::npos) return {};
+            return decl.substr(pos + 1, close - pos - 1);
+        }
+
+        inline bool encoding_is(std::string_view const & name, std::initializer_list<std::string_view> names)
+        {
+            for (auto const & candidate : names) {
+                if (std::equal(name.begin(), name.end(), candidate.begin(), candidate.end(), [](char a, char b) {
+                    return (a >= 'a' && a <= 'z' ? a - 'a' + 'A' : a) == b;
+                })) return true;
+            }
+            return false;
+        }
+
+        inline char *append_utf8(char *out, std::uint32_t code)
+        {
+            if (code < 0x80) {
+                *out++ = static_cast<char>(code);
+            } else if (code < 0x800) {
+                *out++ = static_cast<char>(0xC0 | (code >> 6));
+                *out++ = static_cast<char>(0x80 | (code & 0x3F));
+            } else if (code < 0x10000) {
+                *out++ = static_cast<char>(0xE0 | (code >> 12));
+                *out++ = static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+                *out++ = static_cast<char>(0x80 | (code & 0x3F));
+            } else {
+                *out++ = static_cast<char>(0xF0 | (code >> 18));
+                *out++ = static_cast<char>(0x80 | ((code >> 12) & 0x3F));
+                *out++ = static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+                *out++ = static_cast<char>(0x80 | (code & 0x3F));
+            }
+            return out;
+        }
+
+        template<bool BigEndian>
+        inline std::uint32_t load_unit16(const unsigned char *p)
+        {
+            return BigEndian ? (p[0] << 8) | p[1] : p[0] | (p[1] << 8);
+        }
+
+        template<bool BigEndian>
+        inline std::uint32_t load_unit32(const unsigned char *p)
+        {
+            return BigEndian ? (std::uint32_t(p[0]) << 24) | (p[1] << 16) | (p[2] << 8) | p[3]
+                             : p[0] | (p[1] << 8) | (p[2] << 16) | (std::uint32_t(p[3]) << 24);
+        }
+
+        // Transcode UTF-16 to UTF-8; out must have room for three bytes per unit.
+        template<bool BigEndian>
+        inline char *transcode_utf16(const unsigned char *p, const unsigned char *end, char *out)
+        {
+            while (p != end) {
+#if defined(__SSE2__) && !defined(FLXML_NO_SIMD)
+                // Markup and most text are ASCII, so narrow eight units at a time while they are.
+                while (end - p >= 16) {
+                    __m128i units = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+                    if constexpr (BigEndian)
+                        units = _mm_or_si128(_mm_slli_epi16(units, 8), _mm_srli_epi16(units, 8));
+                    __m128i high = _mm_and_si128(units, _mm_set1_epi16(static_cast<short>(0xFF80)));
+                    if (_mm_movemask_epi8(_mm_cmpeq_epi16(high, _mm_setzero_si128())) != 0xFFFF)
+                        break;
+                    _mm_storel_epi64(reinterpret_cast<__m128i *>(out), _mm_packus_epi16(units, units));
+                    p += 16;
+                    out += 8;
+                }
+                if (p == end) break;
+#endif
+                std::uint32_t unit = load_unit16<BigEndian>(p);
+                p += 2;
+                if (unit >= 0xD800 && unit < 0xDC00) {
+                    if (p == end) throw std::runtime_error("invalid UTF-16");
+                    std::uint32_t low = load_unit16<BigEndian>(p);
+                    if (low < 0xDC00 || low >= 0xE000) throw std::runtime_error("invalid UTF-16");
+                    p += 2;
+                    unit = 0x10000 + ((unit - 0xD800) << 10) + (low - 0xDC00);
+                } else if (unit >= 0xDC00 && unit < 0xE000) {
+                    throw std::runtime_error("invalid UTF-16");
+                }
+                out = append_utf8(out, unit);
+            }
+            return out;
+        }
+
+        // Transcode UTF-32 to UTF-8; out must have room for four bytes per unit.
+        template<bool BigEndian>
+        inline char *transcode_utf32(const unsigned char *p, const unsigned char *end, char *out)
+        {
+            while (p != end) {
+#if defined(__SSE2__) && !defined(FLXML_NO_SIMD)
+                // Narrow four units at a time while they are ASCII.
+                while (end - p >= 16) {
+                    __m128i units = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+                    if constexpr (BigEndian) {
+                        units = _mm_or_si128(_mm_slli_epi16(units, 8), _mm_srli_epi16(units, 8));
+                        units = _mm_shufflelo_epi16(_mm_shufflehi_epi16(units, 0xB1), 0xB1);
+                    }
+                    __m128i high = _mm_and_si128(units, _mm_set1_epi32(static_cast<int>(0xFFFFFF80)));
+                    if (_mm_movemask_epi8(_mm_cmpeq_epi32(high, _mm_setzero_si128())) != 0xFFFF)
+                        break;
+                    __m128i narrow = _mm_packs_epi32(units, units);
+                    int bytes = _mm_cvtsi128_si32(_mm_packus_epi16(narrow, narrow));
+                    std::memcpy(out, &bytes, 4);
+                    p += 16;
+                    out += 4;
+                }
+                if (p == end) break;
+#endif
+                std::uint32_t unit = load_unit32<BigEndian>(p);
+                p += 4;
+                if (unit > 0x10FFFF || (unit >= 0xD800 && unit < 0xE000))
+                    throw std::runtime_error("invalid UTF-32");
+                out = append_utf8(out, unit);
+            }
+            return out;
+        }
+    }
+    //! \endcond
+
+    //! Detects the encoding of input from its byte order mark, or as XML's Appendix F describes, from how
+    //! the XML declaration is encoded and what encoding it names. Input with neither is taken as UTF-8.
+    //! \param bytes Start of input; the first few hundred bytes are enough.
+    //! \param bom_size Set to the size of any byte order mark.
+    //! \return Encoding of the input.
+    inline input_encoding detect_encoding(std::string_view const & bytes, std::size_t & bom_size)
+    {
+        auto starts = [&bytes](std::initializer_list<unsigned char> prefix) {
+            return bytes.size() >= prefix.size()
+                   && std::equal(prefix.begin(), prefix.end(), bytes.begin(), [](unsigned char a, char b) {
+                       return a == static_cast<unsigned char>(b);
+                   });
+        };
+        auto bom = [&bom_size](std::size_t size, input_encoding encoding) {
+            bom_size = size;
+            return encoding;
+        };
+        bom_size = 0;
+        // UTF-32 first, since its little-endian BOM begins with UTF-16's.
+        if (starts({0x00, 0x00, 0xFE, 0xFF})) return bom(4, input_encoding::utf32be);
+        if (starts({0xFF, 0xFE, 0x00, 0x00})) return bom(4, input_encoding::utf32le);
+        if (starts({0xFE, 0xFF})) return bom(2, input_encoding::utf16be);
+        if (starts({0xFF, 0xFE})) return bom(2, input_encoding::utf16le);
+        if (starts({0xEF, 0xBB, 0xBF})) return bom(3, input_encoding::utf8);
+        if (starts({0x00, 0x00, 0x00, 0x3C})) return input_encoding::utf32be;
+        if (starts({0x3C, 0x00, 0x00, 0x00})) return input_encoding::utf32le;
+        if (starts({0x00, 0x3C, 0x00, 0x3F})) return input_encoding::utf16be;
+        if (starts({0x3C, 0x00, 0x3F, 0x00})) return input_encoding::utf16le;
+        auto declared = internal::declared_encoding(bytes);
+        if (declared.empty() || internal::encoding_is(declared, {"UTF-8", "US-ASCII", "ASCII"}))
+            return input_encoding::utf8;
+        if (internal::encoding_is(declared, {"ISO-8859-1", "ISO_8859-1", "LATIN1", "L1"}))
+            return input_encoding::latin1;
+        throw std::runtime_error("unsupported encoding " + std::string(declared));
+    }
+
+    //! Holds input as UTF-8, for parsing with xml_document<char>.
+    //! UTF-8 input is used as it is, less any byte order mark; other encodings are transcoded once,
+    //! straight into a single buffer. This is faster than parsing with a wider character type, whose
+    //! lookup tables only cover single bytes, and needs no separate converter.
+    class utf8_input
+    {
+    public:
+        //! Detects the encoding of input and transcodes it if need be.
+        //! \param bytes Input, which must outlive this if it is UTF-8.
+        explicit utf8_input(std::string_view const & bytes)
+        {
+            std::size_t bom_size;
+            m_encoding = detect_encoding(bytes, bom_size);
+            auto p = reinterpret_cast<const unsigned char *>(bytes.data()) + bom_size;
+            auto size = bytes.size() - bom_size;
+            char *out = nullptr;
+            switch (m_encoding) {
+            case input_encoding::utf8:
+                m_view = bytes.substr(bom_size);
+                return;
+            case input_encoding::latin1:
+                m_buffer.resize(size * 2);
+                out = m_buffer.data();
+                for (auto end = p + size; p != end; ++p)
+                    out = internal::append_utf8(out, *p);
+                break;
+            case input_encoding::utf16le:
+            case input_encoding::utf16be:
+                if (size % 2) throw std::runtime_error("invalid UTF-16");
+                m_buffer.resize(size / 2 * 3);
+                out = m_encoding == input_encoding::utf16le
+                      ? internal::transcode_utf16<false>(p, p + size, m_buffer.data())
+                      : internal::transcode_utf16<true>(p, p + size, m_buffer.data());
+                break;
+            case input_encoding::utf32le:
+            case input_encoding::utf32be:
+                if (size % 4) throw std::runtime_error("invalid UTF-32");
+                m_buffer.resize(size);
+                out = m_encoding == input_encoding::utf32le
+                      ? internal::transcode_utf32<false>(p, p + size, m_buffer.data())
+                      : internal::transcode_utf32<true>(p, p + size, m_buffer.data());
+                break;
+            }
+            m_buffer.resize(out - m_buffer.data());
+            m_view = m_buffer;
+        }
+
+        utf8_input(utf8_input const &) = delete;
+        utf8_input & operator = (utf8_input const &) = delete;
+
+        //! Gets the input as UTF-8, for parsing.
+        std::string_view view() const
+        {
+            return m_view;
+        }
+
+        //! Gets the encoding the input was detected as.
+        input_encoding encoding() const
+        {
+            return m_encoding;
+        }
+
+    private:
+        std::string m_buffer;       // Transcoded input, if not UTF-8
+        std::string_view m_view;
+        input_encoding m_encoding;
+    };
+
     //! Counts children of node. Time complexity is O(n).
     //! \return Number of children of node
     template<class Ch>
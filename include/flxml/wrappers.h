@@ -8,6 +8,8 @@
 #include <type_traits>
 #include <numeric>
 #include <stdexcept>
+#include <span>
+#include <string_view>
 
 namespace flxml {
     // Most of rapidxml was written to use a NUL-terminated Ch * for parsing.
@@ -128,6 +130,159 @@ namespace flxml {
         return it;
     }
 
+    // Supplies a segmented_ptr with segments as they are produced, such as by a decompressor, so that parsing
+    // can start before the input is complete. Segments are appended to a table which never moves.
+    template<typename Ch>
+    class segment_feed {
+    public:
+        using segment = std::basic_string_view<Ch>;
+        virtual ~segment_feed() = default;
+        // Waits until there is a segment after last, or the input has ended, and returns the last segment now
+        // in the table; this is last itself only once the input has ended.
+        virtual const segment * more(const segment * last) = 0;
+    };
+
+    // Like buffer_ptr, but over a list of segments which need not be contiguous, such as a chain of
+    // network buffers. Within a segment it is a plain pointer; it, and end_it, cover the current segment,
+    // so scanners can run over each segment in turn and only call next_segment() at its end.
+    // It is kept at the start of the next segment rather than the end of the last, except at the end of all
+    // segments, so each position has one representation, and dereferences to NUL only at the end.
+    // With a segment_feed, the list grows as the end of it is reached.
+    template<typename Ch>
+    struct segmented_ptr {
+        using iterator_category = std::bidirectional_iterator_tag;
+        using difference_type = std::ptrdiff_t;
+        using value_type = Ch;
+        using pointer = const Ch *;
+        using reference = const Ch &;
+        using segment = std::basic_string_view<Ch>;
+
+        const segment * seg = nullptr;
+        const segment * last_seg = nullptr;
+        const Ch * it = nullptr;
+        const Ch * end_it = nullptr;
+        segment_feed<Ch> * feed = nullptr;
+        static constexpr value_type end_char = value_type(0);
+
+        explicit segmented_ptr(std::span<const segment> segments, segment_feed<Ch> * feed = nullptr) : feed(feed) {
+            if (segments.empty()) return;
+            seg = segments.data();
+            last_seg = seg + segments.size() - 1;
+            it = seg->data();
+            end_it = it + seg->size();
+            if (it == end_it) next_segment();
+        }
+        segmented_ptr() = default;
+
+        // Moves to the start of the next non-empty segment, if there is one, waiting on the feed for it if need be.
+        bool next_segment() {
+            for (auto s = seg; s != last_seg || (feed && (last_seg = feed->more(last_seg)) != s); ) {
+                if (!(++s)->empty()) {
+                    seg = s;
+                    it = s->data();
+                    end_it = it + s->size();
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        // Finds where a range from here to end finishes in this segment, if it does not go beyond it.
+        // Returns nullptr if the range straddles segments.
+        const Ch * contiguous_end(segmented_ptr const & end) const {
+            if (end.seg == seg) return end.it;
+            if (end.it != end.seg->data()) return nullptr;
+            // The end is at the start of a later segment, so the range may finish at the end of this one.
+            auto s = end.seg - 1;
+            while (s > seg && s->empty()) --s;
+            return s == seg ? seg->data() + seg->size() : nullptr;
+        }
+
+        reference operator[](difference_type i) const {
+            if (i < end_it - it) return it[i];
+            return *(*this + i);
+        }
+        pointer operator -> () const {
+            if (it == end_it) return &end_char;
+            return it;
+        }
+        reference operator *() const {
+            if (it == end_it) return end_char;
+            return *it;
+        }
+
+        auto operator <=> (segmented_ptr const & other) const {
+            if (seg != other.seg) return seg <=> other.seg;
+            return it <=> other.it;
+        }
+        // Segments may share memory, so the same pointer in two segments is two places.
+        bool operator == (segmented_ptr const & other) const {
+            return seg == other.seg && it == other.it;
+        }
+
+        segmented_ptr & operator ++() {
+            if (++it == end_it) next_segment();
+            return *this;
+        }
+        segmented_ptr operator ++(int) {
+            auto old = *this;
+            ++*this;
+            return old;
+        }
+        segmented_ptr & operator --() {
+            while (it == seg->data()) {
+                --seg;
+                it = end_it = seg->data() + seg->size();
+            }
+            --it;
+            return *this;
+        }
+        segmented_ptr operator --(int) {
+            auto old = *this;
+            --*this;
+            return old;
+        }
+
+        // Steps stop at the end of the last segment.
+        segmented_ptr & operator += (difference_type n) {
+            if (n < 0) return *this -= -n;
+            while (n >= end_it - it) {
+                n -= end_it - it;
+                it = end_it;
+                if (!next_segment()) return *this;
+            }
+            it += n;
+            return *this;
+        }
+        segmented_ptr & operator -= (difference_type n) {
+            if (n < 0) return *this += -n;
+            while (n > it - seg->data()) {
+                n -= it - seg->data();
+                --seg;
+                it = end_it = seg->data() + seg->size();
+            }
+            it -= n;
+            return *this;
+        }
+        segmented_ptr operator + (difference_type n) const {
+            segmented_ptr other(*this);
+            return other += n;
+        }
+        segmented_ptr operator - (difference_type n) const {
+            segmented_ptr other(*this);
+            return other -= n;
+        }
+
+        difference_type operator - (segmented_ptr const & other) const {
+            if (seg == other.seg) return it - other.it;
+            if (seg < other.seg) return -(other - *this);
+            difference_type n = other.seg->data() + other.seg->size() - other.it;
+            for (auto s = other.seg + 1; s != seg; ++s)
+                n += static_cast<difference_type>(s->size());
+            return n + (it - seg->data());
+        }
+    };
+
     class no_such_node : std::runtime_error {
     public:
         no_such_node() : std::runtime_error("No such node") {}
@@ -0,0 +1,239 @@
+#ifndef FLXML_WRITER_HPP_INCLUDED
+#define FLXML_WRITER_HPP_INCLUDED
+
+//! \file writer.h This file contains a streaming XML writer, which needs no document.
+
+#include <flxml/print.h>
+#include <string>
+#include <vector>
+#include <tuple>
+#include <stdexcept>
+#include <initializer_list>
+
+namespace flxml
+{
+
+    //! Thrown when xml_writer calls are made out of order, such as an attribute after text.
+    class writer_error : public std::logic_error
+    {
+    public:
+        using std::logic_error::logic_error;
+    };
+
+    //! Writes escaped XML directly to an output iterator, without building nodes.
+    //! Elements are written as they are started and ended, with no indenting; the output matches print() with
+    //! print_no_indenting for the equivalent tree. Namespaces given in Clark notation are declared as
+    //! xml_node::append_element() does: an element in a different namespace from its parent gets an xmlns
+    //! attribute, and one in the same namespace takes its parent's prefix.
+    //! Names and values are only used during the call, so temporaries are fine.
+    //! \param Ch Character type to use.
+    //! \param OutIt Output iterator to write to; print_buffer_iterator and Ch * are written in bulk.
+    template<typename Ch, typename OutIt>
+    class xml_writer
+    {
+    public:
+        using view_type = std::basic_string_view<Ch>;
+
+        explicit xml_writer(OutIt out) : m_out(out) {}
+
+        //! Starts an element in its parent's namespace.
+        //! \param name Name of the element, including any prefix.
+        xml_writer & start_element(view_type const & name)
+        {
+            auto colon = name.find(Ch(':'));
+            if (colon == view_type::npos) {
+                open(name, 0, xmlns());
+            } else {
+                // The prefix is bound by an attribute to come, if not by an ancestor.
+                open(name, colon, xmlns_of(name.substr(0, colon)));
+            }
+            return *this;
+        }
+
+        //! Starts an element in the given namespace.
+        //! \param clark_name Namespace and name of the element.
+        xml_writer & start_element(std::tuple<view_type, view_type> const & clark_name)
+        {
+            auto [ns, name] = clark_name;
+            if (ns != xmlns()) {
+                open(name, 0, ns);
+                attribute(view_type(s_xmlns), ns);
+            } else if (!prefix().empty()) {
+                std::basic_string<Ch> pname{prefix()};
+                pname += Ch(':');
+                pname += name;
+                open(pname, prefix().size(), ns);
+            } else {
+                open(name, 0, ns);
+            }
+            return *this;
+        }
+        xml_writer & start_element(std::initializer_list<const Ch *> const & clark_name)
+        {
+            auto it = clark_name.begin();
+            auto a = *it;
+            auto b = *++it;
+            return start_element(std::tuple<view_type, view_type>{a, b});
+        }
+
+        //! Writes an attribute on the element just started.
+        //! An xmlns or xmlns:prefix attribute also binds the namespace for this element and its descendants.
+        //! \param name Name of the attribute, including any prefix.
+        //! \param value Value of the attribute, which will be escaped.
+        xml_writer & attribute(view_type const & name, view_type const & value)
+        {
+            if (!m_start_open) throw writer_error("attribute outside start tag");
+            *m_out = Ch(' '), ++m_out;
+            m_out = internal::copy_chars(name, m_out);
+            *m_out = Ch('='), ++m_out;
+            Ch quote = value.find(Ch('"')) == view_type::npos ? Ch('"') : Ch('\'');
+            *m_out = quote, ++m_out;
+            m_out = internal::copy_and_expand_chars(value, quote == Ch('"') ? Ch('\'') : Ch('"'), m_out);
+            *m_out = quote, ++m_out;
+            if (name.starts_with(view_type(s_xmlns))) {
+                auto & element = m_open.back();
+                if ((name.size() == 5 && element.prefix_size == 0) || (name.size() > 5 && name[5] == Ch(':') && name.substr(6) == prefix())) {
+                    element.ns = m_names.size();
+                    element.ns_size = value.size();
+                    m_names += value;
+                }
+            }
+            return *this;
+        }
+
+        //! Writes text content within the current element, escaping it.
+        //! Empty text writes nothing, so an element with no other content still ends as an empty-element tag.
+        xml_writer & text(view_type const & value)
+        {
+            if (m_open.empty()) throw writer_error("text outside element");
+            if (value.empty()) return *this;
+            close_start();
+            m_out = internal::copy_and_expand_chars(value, Ch(0), m_out);
+            return *this;
+        }
+
+        //! Ends the current element, as an empty-element tag if nothing was written inside it.
+        xml_writer & end_element()
+        {
+            if (m_open.empty()) throw writer_error("no element to end");
+            auto & element = m_open.back();
+            if (m_start_open) {
+                *m_out = Ch('/'), ++m_out;
+                *m_out = Ch('>'), ++m_out;
+                m_start_open = false;
+            } else {
+                *m_out = Ch('<'), ++m_out;
+                *m_out = Ch('/'), ++m_out;
+                m_out = internal::copy_chars(view_type(m_names).substr(element.name, element.name_size), m_out);
+                *m_out = Ch('>'), ++m_out;
+            }
+            m_names.resize(element.name);
+            m_open.pop_back();
+            return *this;
+        }
+
+        //! Convenience for an element holding only text.
+        xml_writer & element(view_type const & name, view_type const & value)
+        {
+            return start_element(name).text(value).end_element();
+        }
+        xml_writer & element(std::tuple<view_type, view_type> const & clark_name, view_type const & value)
+        {
+            return start_element(clark_name).text(value).end_element();
+        }
+        xml_writer & element(std::initializer_list<const Ch *> const & clark_name, view_type const & value)
+        {
+            return start_element(clark_name).text(value).end_element();
+        }
+
+        //! Gets the number of elements started but not yet ended.
+        std::size_t depth() const
+        {
+            return m_open.size();
+        }
+
+        //! Gets the output iterator, positioned after everything written so far.
+        OutIt out() const
+        {
+            return m_out;
+        }
+
+    private:
+        // Open elements keep their names and namespaces as offsets into m_names, so that
+        // writing needs no allocation once the buffer has grown to the deepest stanza.
+        struct open_element {
+            std::size_t name;
+            std::size_t name_size;
+            std::size_t prefix_size;
+            std::size_t ns;
+            std::size_t ns_size;
+        };
+
+        void open(view_type const & name, std::size_t prefix_size, view_type const & ns)
+        {
+            close_start();
+            // The namespace may be an ancestor's, within m_names; find its offset before appending.
+            std::size_t ns_offset;
+            if (ns.data() >= m_names.data() && ns.data() < m_names.data() + m_names.size()) {
+                ns_offset = ns.data() - m_names.data();
+            } else {
+                ns_offset = m_names.size() + name.size();
+            }
+            std::size_t offset = m_names.size();
+            m_names += name;
+            if (ns_offset >= offset) m_names += ns;
+            m_open.push_back({offset, name.size(), prefix_size, ns_offset, ns.size()});
+            *m_out = Ch('<'), ++m_out;
+            m_out = internal::copy_chars(name, m_out);
+            m_start_open = true;
+        }
+
+        void close_start()
+        {
+            if (m_start_open) {
+                *m_out = Ch('>'), ++m_out;
+                m_start_open = false;
+            }
+        }
+
+        view_type xmlns() const
+        {
+            if (m_open.empty()) return {};
+            auto const & element = m_open.back();
+            return view_type(m_names).substr(element.ns, element.ns_size);
+        }
+
+        view_type prefix() const
+        {
+            if (m_open.empty()) return {};
+            auto const & element = m_open.back();
+            return view_type(m_names).substr(element.name, element.prefix_size);
+        }
+
+        // Find the namespace of the nearest open element using the given prefix.
+        view_type xmlns_of(view_type const & prefix) const
+        {
+            for (auto it = m_open.rbegin(); it != m_open.rend(); ++it) {
+                if (view_type(m_names).substr(it->name, it->prefix_size) == prefix)
+                    return view_type(m_names).substr(it->ns, it->ns_size);
+            }
+            return {};
+        }
+
+        static constexpr Ch s_xmlns[] = {Ch('x'), Ch('m'), Ch('l'), Ch('n'), Ch('s'), Ch(0)};
+
+        OutIt m_out;
+        std::basic_string<Ch> m_names;
+        std::vector<open_element> m_open;
+        bool m_start_open = false;
+    };
+
+    template<typename Ch>
+    xml_writer(print_buffer_iterator<Ch>) -> xml_writer<Ch, print_buffer_iterator<Ch>>;
+    template<typename Ch>
+    xml_writer(Ch *) -> xml_writer<Ch, Ch *>;
+    template<typename Ch>
+    xml_writer(std::back_insert_iterator<std::basic_string<Ch>>) -> xml_writer<Ch, std::back_insert_iterator<std::basic_string<Ch>>>;
+}
+
+#endif
@@ -0,0 +1,114 @@
+//
+// Tests for the binary document form.
+//
+
+#include <gtest/gtest.h>
+#include <flxml.h>
+#include <flxml/binary.h>
+#include <fstream>
+#include <iterator>
+
+namespace {
+    std::string binary(flxml::xml_document<> const & doc) {
+        std::string out;
+        flxml::write_binary(std::back_inserter(out), doc);
+        return out;
+    }
+
+    // The loader needs the same alignment mmap gives.
+    struct aligned_bytes {
+        std::vector<std::uint32_t> storage;
+        std::string_view view;
+        explicit aligned_bytes(std::string const & bytes) : storage(bytes.size() / 4 + 1) {
+            std::memcpy(storage.data(), bytes.data(), bytes.size());
+            view = {reinterpret_cast<const char *>(storage.data()), bytes.size()};
+        }
+    };
+}
+
+TEST(Binary, Navigate) {
+    std::string text = "<?xml version='1.0'?><config xmlns='urn:example' xmlns:x='urn:x'>"
+                       "<item id='1' x:flag='on'>one &amp; only</item><item id='2'/><x:other>three</x:other><!--note--></config>";
+    flxml::xml_document<> doc;
+    doc.parse<flxml::parse_full>(text);
+    auto bytes = binary(doc);
+    aligned_bytes data(bytes);
+    flxml::binary_document<> bin(data.view);
+
+    auto decl = bin.first_node();
+    EXPECT_EQ(decl->type(), flxml::node_declaration);
+    EXPECT_EQ(decl->first_attribute("version")->value(), "1.0");
+    auto config = bin.first_node("config", "urn:example");
+    ASSERT_TRUE(config);
+    EXPECT_EQ(config->xmlns(), "urn:example");
+    EXPECT_EQ(config->parent(), bin);
+    auto item = config->first_node("item");
+    EXPECT_EQ(item->value(), "one & only");
+    EXPECT_EQ(item->first_attribute("id")->value(), "1");
+    EXPECT_EQ(item->first_attribute("x:flag")->xmlns(), "urn:x");
+    EXPECT_EQ(item->first_attribute()->next_attribute()->name(), "x:flag");
+    EXPECT_FALSE(item->first_attribute()->next_attribute()->next_attribute());
+    auto second = item->next_sibling("item");
+    EXPECT_EQ(second->first_attribute("id")->value(), "2");
+    EXPECT_EQ(second->previous_sibling(), item);
+    EXPECT_FALSE(second->next_sibling("item"));
+    EXPECT_EQ(config->last_node("other", "urn:x")->value(), "three");
+    EXPECT_EQ(config->last_node("other", "urn:x")->prefix(), "x");
+    EXPECT_EQ(config->last_node()->type(), flxml::node_comment);
+    EXPECT_FALSE(config->first_node("missing"));
+    EXPECT_THROW(config->first_node("missing")->name(), flxml::no_such_node);
+
+    std::vector<std::string> names;
+    for (auto child : config->children()) names.emplace_back(child.name());
+    EXPECT_EQ(names, (std::vector<std::string>{"item", "item", "other", ""}));
+    std::size_t count = 0;
+    for (auto attr : config->attributes()) {
+        EXPECT_TRUE(attr.name().starts_with("xmlns"));
+        ++count;
+    }
+    EXPECT_EQ(count, 2);
+
+    // Repeated strings are stored once.
+    EXPECT_EQ(bin.first_node("config")->first_node()->name().data(),
+              bin.first_node("config")->first_node()->next_sibling()->name().data());
+}
+
+TEST(Binary, Corrupt) {
+    flxml::xml_document<> doc;
+    std::string text = "<a><b c='d'/></a>";
+    doc.parse<0>(text);
+    auto bytes = binary(doc);
+    {
+        aligned_bytes data(bytes.substr(0, bytes.size() - 1));
+        EXPECT_THROW(flxml::binary_document<>{data.view}, flxml::binary_error);
+    }
+    {
+        auto bad = bytes;
+        bad[0] = 'X';
+        aligned_bytes data(bad);
+        EXPECT_THROW(flxml::binary_document<>{data.view}, flxml::binary_error);
+    }
+    {
+        // Point the root's children beyond the node table.
+        auto bad = bytes;
+        bad[32 + 40] = 100;
+        aligned_bytes data(bad);
+        EXPECT_THROW(flxml::binary_document<>{data.view}, flxml::binary_error);
+    }
+}
+
+#ifdef FLXML_HAS_MMAP
+TEST(Binary, File) {
+    flxml::xml_document<> doc;
+    std::string text = "<a><b>text</b></a>";
+    doc.parse<0>(text);
+    auto filename = testing::TempDir() + "flxml-binary.bin";
+    {
+        std::ofstream out(filename, std::ios::binary);
+        flxml::write_binary(std::ostreambuf_iterator<char>(out), doc);
+    }
+    flxml::binary_file<> bin(filename.c_str());
+    std::remove(filename.c_str());
+    EXPECT_EQ(bin.first_node("a")->first_node("b")->value(), "text");
+}
+#endif
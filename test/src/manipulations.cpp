@@ -115,3 +115,105 @@ TEST(Create, NodeAttr) {
             "<fish>\n\t<shark xmlns=\"urn:xmpp:fish:0\">\n\t\t<species>tiger</species>\n\t</shark>\n</fish>\n"
     );
 }
+
+TEST(Create, WideNodeLookup) {
+    flxml::xml_document<> doc;
+    auto root = doc.append_element("root");
+    std::vector<flxml::xml_node<> *> fish;
+    for (int i = 0; i != 200; ++i) {
+        root->append_element("chips");
+        fish.push_back(root->append_element("fish").get());
+    }
+    // Long scans build the index; the answers must not change once it is there.
+    EXPECT_EQ(root->last_node("fish"), fish.back());
+    EXPECT_EQ(root->first_node("fish"), fish.front());
+    EXPECT_EQ(root->first_node("cake"), nullptr);
+    int count = 0;
+    for (auto f = root->first_node("fish"); f; f = f->next_sibling("fish")) {
+        EXPECT_EQ(f, fish[count]);
+        ++count;
+    }
+    EXPECT_EQ(count, 200);
+    EXPECT_EQ(fish[10]->previous_sibling("fish"), fish[9]);
+    EXPECT_EQ(fish[10]->next_sibling("chips"), fish[10]->next_sibling());
+
+    // Mutations keep the index coherent.
+    auto front = root->prepend_node(doc.allocate_node(flxml::node_element, "fish"));
+    EXPECT_EQ(root->first_node("fish"), front);
+    EXPECT_EQ(fish[0]->previous_sibling("fish"), front);
+    root->remove_node(fish[5]);
+    EXPECT_EQ(fish[4]->next_sibling("fish"), fish[6]);
+    root->remove_last_node();
+    EXPECT_EQ(root->last_node("fish"), fish[198]);
+    EXPECT_EQ(fish[198]->next_sibling("fish"), nullptr);
+    auto middle = root->insert_node(fish[100], doc.allocate_node(flxml::node_element, "fish"));
+    EXPECT_EQ(fish[99]->next_sibling("fish"), middle);
+    EXPECT_EQ(middle->next_sibling("fish"), fish[100]);
+    fish[50]->name("trout");
+    EXPECT_EQ(fish[49]->next_sibling("fish"), fish[51]);
+    EXPECT_EQ(root->first_node("trout"), fish[50]);
+    root->remove_first_node();
+    EXPECT_EQ(root->first_node("fish"), fish[0]);
+
+    // Namespaces still apply.
+    auto other = root->append_element({"urn:other", "fish"});
+    EXPECT_EQ(root->last_node("fish"), other);
+    EXPECT_EQ(root->first_node("fish", "urn:other"), other);
+    EXPECT_EQ(other->previous_sibling("fish"), nullptr);
+    auto early = root->insert_node(fish[2], doc.allocate_node(flxml::node_element, "fish"));
+    EXPECT_EQ(fish[1]->next_sibling("fish"), early);
+    EXPECT_EQ(early->next_sibling("fish"), fish[2]);
+    fish[60]->name("chips");
+    EXPECT_EQ(fish[59]->next_sibling("fish"), fish[61]);
+    EXPECT_EQ(fish[60]->previous_sibling("chips"), fish[60]->previous_sibling());
+    root->remove_all_nodes();
+    EXPECT_EQ(root->first_node("fish"), nullptr);
+    // The emptied index is reused.
+    for (int i = 0; i != 40; ++i) root->append_element("chips");
+    auto again = root->append_element("fish");
+    EXPECT_EQ(root->first_node("fish"), again);
+    EXPECT_EQ(root->first_node("chips")->next_sibling("fish"), again);
+}
+
+TEST(Create, WideUnnamedChildren) {
+    flxml::xml_document<> doc;
+    auto root = doc.append_element("root");
+    for (int i = 0; i != 40; ++i)
+        root->append_node(doc.allocate_node(flxml::node_data, {}, "x"));
+    // The first lookup builds an index holding no names; later ones must cope with that.
+    EXPECT_EQ(root->first_node("fish"), nullptr);
+    EXPECT_EQ(root->first_node("fish"), nullptr);
+    EXPECT_EQ(root->last_node("fish"), nullptr);
+    auto fish = root->append_element("fish");
+    EXPECT_EQ(root->first_node("fish"), fish);
+}
+
+TEST(Create, MutationBatch) {
+    std::string text = "<a><b><c>x</c><c>y</c></b><d>z</d></a>";
+    flxml::xml_document<> doc;
+    doc.parse<0>(text);
+    auto a = doc.first_node();
+    auto b = a->first_node("b");
+    auto d = a->first_node("d");
+    EXPECT_TRUE(a->clean());
+    EXPECT_TRUE(b->clean());
+    {
+        flxml::mutation_batch batch(doc);
+        {
+            flxml::mutation_batch nested(doc);
+            b->first_node()->value("changed");
+            b->last_node()->append_element("e");
+        }
+        // Ancestors are only marked once the outermost batch ends.
+        EXPECT_FALSE(b->first_node()->clean());
+        EXPECT_TRUE(b->clean());
+        EXPECT_TRUE(a->clean());
+    }
+    EXPECT_FALSE(b->clean());
+    EXPECT_FALSE(a->clean());
+    EXPECT_TRUE(d->clean());
+    EXPECT_EQ(
+        print(doc),
+        "<a>\n\t<b>\n\t\t<c>changed</c>\n\t\t<c>\n\t\t\ty\n\t\t\t<e/>\n\t\t</c>\n\t</b>\n\t<d>z</d>\n</a>\n"
+    );
+}
@@ -4,6 +4,12 @@
 
 #include <gtest/gtest.h>
 #include <flxml.h>
+#include <flxml/utils.h>
+#include <flxml/sequence.h>
+#include <fstream>
+#include <sstream>
+#include <random>
+#include <limits>
 
 TEST(Parser, SingleElement) {
     char doc_text[] = "<single-element/>";
@@ -228,6 +234,150 @@ TEST(ParseOptions, ParseOne) {
     }
 }
 
+TEST(ParseOptions, Sequence) {
+    std::string text = "<?xml version='1.0'?><a n='1'/>\n<!-- note --><b><c/></b>\n\n<a n='3'>text</a>\n";
+    flxml::document_sequence<flxml::parse_full> sequence(text);
+    std::vector<std::string> names;
+    for (auto & doc : sequence) {
+        // Declarations and comments come first, with the element last.
+        names.emplace_back(doc.last_node()->name());
+        EXPECT_EQ(doc.last_node()->type(), flxml::node_element);
+        if (names.size() == 2) {
+            EXPECT_EQ(sequence.item(), "<!-- note --><b><c/></b>");
+            EXPECT_EQ(sequence.remaining(), "\n\n<a n='3'>text</a>\n");
+        }
+    }
+    EXPECT_EQ(names, (std::vector<std::string>{"a", "b", "a"}));
+    EXPECT_EQ(sequence.item(), "");
+
+    // Stanzas within a stream take namespaces from the stream's element.
+    flxml::xml_document<> stream;
+    std::string header = "<stream:stream xmlns='jabber:client' xmlns:stream='http://etherx.jabber.org/streams'>";
+    stream.parse<flxml::parse_open_only>(header);
+    std::string stanzas = "<message><body>1</body></message><presence/>";
+    flxml::document_sequence<flxml::parse_fastest> in_stream(stanzas, false, &stream);
+    auto it = in_stream.begin();
+    auto message = it->first_node();
+    EXPECT_EQ(message->xmlns(), "jabber:client");
+    ++it;
+    EXPECT_EQ(it->first_node()->name(), "presence");
+    // Without resetting, earlier items stay valid.
+    EXPECT_EQ(message->first_node()->value(), "1");
+    ++it;
+    EXPECT_TRUE(it == std::default_sentinel);
+
+    std::string bad = "<a/><b>";
+    flxml::document_sequence<> broken(bad);
+    auto b = broken.begin();
+    EXPECT_THROW(++b, flxml::parse_error);
+}
+
+TEST(ParseOptions, StanzaScanner) {
+    std::string stream = "<?xml version='1.0'?>"
+        "<stream:stream xmlns='jabber:client' xmlns:stream='http://etherx.jabber.org/streams'>"
+        "<message to='a@b' note='<not a tag/>'><body>1 &lt; 2</body></message>\n"
+        "<presence/>"
+        "<iq type=\"get\"><!-- </iq> --><query><![CDATA[</iq><iq>]]></query><?pi </iq>?></iq>"
+        "</stream:stream>";
+    std::vector<std::string> expected = {
+        "<?xml version='1.0'?>",
+        "<stream:stream xmlns='jabber:client' xmlns:stream='http://etherx.jabber.org/streams'>",
+        "<message to='a@b' note='<not a tag/>'><body>1 &lt; 2</body></message>",
+        "\n<presence/>",
+        "<iq type=\"get\"><!-- </iq> --><query><![CDATA[</iq><iq>]]></query><?pi </iq>?></iq>",
+        "</stream:stream>",
+    };
+    // The same boundaries are found however the text arrives.
+    for (std::size_t piece : {std::size_t(1), std::size_t(2), std::size_t(7), stream.size()}) {
+        flxml::stanza_scanner scanner;
+        std::vector<std::string> stanzas;
+        std::string pending;
+        for (std::size_t offset = 0; offset < stream.size(); offset += piece) {
+            std::string_view arrived = std::string_view(stream).substr(offset, piece);
+            while (!arrived.empty()) {
+                auto used = scanner.feed(arrived);
+                pending += arrived.substr(0, used);
+                arrived.remove_prefix(used);
+                if (scanner.boundary()) {
+                    stanzas.push_back(pending);
+                    pending.clear();
+                }
+            }
+        }
+        EXPECT_EQ(stanzas, expected) << "piece size " << piece;
+        EXPECT_EQ(scanner.depth(), 0);
+    }
+    flxml::stanza_scanner scanner;
+    std::string_view stray = "</stream:stream>";
+    try {
+        scanner.feed(stray);
+        ADD_FAILURE() << "no parse_error";
+    } catch (flxml::parse_error & e) {
+        // The error points at the end tag's closing '>'.
+        EXPECT_EQ(e.where<const char>(), stray.data() + stray.size() - 1);
+    }
+}
+
+TEST(ParseOptions, ValidateChars) {
+    const int Flags = flxml::parse_validate_chars | flxml::parse_comment_nodes | flxml::parse_pi_nodes;
+    std::string good = "<r\xC3\xA9 a='caf\xC3\xA9 at the end of a long attribute value' b=\"tab\there\">"
+                       "<!-- \xE2\x82\xAC --><?pi \xF0\x9F\x98\x80?><![CDATA[\xC2\xA3]]>"
+                       "Text long enough for several blocks,\r\n\tincluding \xE2\x82\xAC and &amp; and \xF0\x9F\x98\x80.</r\xC3\xA9>";
+    {
+        flxml::xml_document<> doc;
+        doc.parse<Flags>(good);
+        EXPECT_EQ(doc.first_node()->name(), "r\xC3\xA9");
+    }
+    {
+        flxml::xml_document<> doc;
+        doc.parse<Flags>(std::string_view(good));
+        EXPECT_EQ(doc.first_node()->first_attribute("b")->value(), "tab\there");
+    }
+    std::vector<std::string> bad = {
+        "<r>control \x01 character in some text long enough to use the blocks</r>",
+        "<r a='control \x1F character in an attribute'/>",
+        "<r>lone continuation \x80 byte</r>",
+        "<r>overlong \xC0\xAF slash</r>",
+        "<r>overlong \xE0\x80\xAF slash</r>",
+        "<r>surrogate \xED\xA0\x80</r>",
+        "<r>non-character \xEF\xBF\xBE</r>",
+        "<r>beyond Unicode \xF4\x90\x80\x80</r>",
+        "<r><!-- bad \xFF comment --></r>",
+        "<r\xFF/>",
+        "<r a\xC3='1'/>",
+        "<r>truncated \xE2\x82</r>",
+        "<r a='&#1;'/>",
+        "<r>&#0;</r>",
+        "<r>&#xFFFE;</r>",
+        "<r>&#xD800;</r>",
+    };
+    for (auto const & text : bad) {
+        flxml::xml_document<> unchecked;
+        EXPECT_NO_THROW(unchecked.parse<flxml::parse_comment_nodes>(std::string_view(text))) << text;
+        flxml::xml_document<> doc;
+        EXPECT_THROW(doc.parse<Flags>(text), flxml::parse_error) << text;
+        EXPECT_THROW(doc.parse<Flags>(std::string_view(text)), flxml::parse_error) << text;
+    }
+    // A reference too long to fit is not allowed to wrap around to a valid character.
+    {
+        flxml::xml_document<> doc;
+        EXPECT_THROW(doc.parse<Flags>(std::string_view("<r>&#18446744073709551626;</r>")), flxml::parse_error);
+    }
+    // References to characters that are allowed pass.
+    {
+        flxml::xml_document<> doc;
+        doc.parse<Flags>(std::string_view("<r a='&#9;&#xA;'>&#xD7FF;&#xE000;&#xFFFD;&#x10FFFF;<![CDATA[&#1;]]><!-- &#0; --></r>"));
+        EXPECT_EQ(doc.first_node()->first_attribute()->value(), "\t\n");
+        EXPECT_EQ(doc.first_node()->value(), "\xED\x9F\xBF\xEE\x80\x80\xEF\xBF\xBD\xF4\x8F\xBF\xBF");
+    }
+    // Bounded input can end partway through a sequence.
+    std::string truncated = "<r a='x\xE2\x82";
+    flxml::xml_document<> doc;
+    EXPECT_THROW(doc.parse<Flags>(std::string_view(truncated)), flxml::parse_error);
+    // 8-bit text is only checked for controls.
+    doc.parse<Flags | flxml::parse_no_utf8>(std::string_view("<r>\xFF</r>"));
+}
+
 TEST(ParseOptions, OpenOnlyFastest) {
     flxml::xml_document<> doc;
     char doc_text[] = "<pfx:single xmlns='jabber:client' xmlns:pfx='urn:xmpp:example'><pfx:features><feature1/><feature2/></pfx:features><message to='me@mydomain.com' from='you@yourdomcina.com' xml:lang='en'><body>Hello!</body></message>";
@@ -303,3 +453,440 @@ TEST(Parser_Emoji, SingleEmojiReuse) {
     EXPECT_EQ(4, doc.first_node()->value().size());
 }
 
+
+namespace {
+    std::string many_attributes(unsigned count, std::string const & extra = {}) {
+        std::string text = "<element xmlns:pfx1='urn:fish' xmlns:pfx2='urn:fish'";
+        for (unsigned i = 0; i != count; ++i) {
+            text += " attr" + std::to_string(i) + "='" + std::to_string(i) + "'";
+        }
+        text += extra;
+        text += "/>";
+        return text;
+    }
+}
+
+TEST(Parser, ManyAttributes) {
+    auto text = many_attributes(1000);
+    flxml::xml_document<> doc;
+    doc.parse<0>(text);
+    doc.validate();
+}
+
+TEST(Parser, ManyAttributesDuplicate) {
+    auto text = many_attributes(1000, " attr500='again'");
+    flxml::xml_document<> doc;
+    doc.parse<0>(text);
+    EXPECT_THROW(
+        doc.validate(),
+        flxml::duplicate_attribute
+    );
+}
+
+TEST(Parser, ManyAttributesDuplicatePrefix) {
+    auto text = many_attributes(1000, " pfx1:attr='one' pfx2:attr='two'");
+    flxml::xml_document<> doc;
+    doc.parse<0>(text);
+    EXPECT_THROW(
+        doc.validate(),
+        flxml::duplicate_attribute
+    );
+}
+
+TEST(Parser, ManyAttributesUnbound) {
+    auto text = many_attributes(1000, " pfx3:attr='one'");
+    flxml::xml_document<> doc;
+    doc.parse<0>(text);
+    EXPECT_THROW(
+        doc.validate(),
+        flxml::attr_xmlns_unbound
+    );
+}
+
+TEST(Parser, DocumentPointer) {
+    std::string text;
+    for (int i = 0; i != 500; ++i) text += "<deep>";
+    text += "<leaf attr='&apos;'>&lt;</leaf>";
+    for (int i = 0; i != 500; ++i) text += "</deep>";
+    flxml::xml_document<> doc;
+    doc.parse<0>(text);
+    auto leaf = doc.first_node();
+    while (leaf->first_node() && leaf->first_node()->type() == flxml::node_element) leaf = leaf->first_node();
+    EXPECT_EQ(leaf->name(), "leaf");
+    EXPECT_EQ(leaf->document(), &doc);
+    EXPECT_EQ(leaf->first_attribute()->document(), &doc);
+    EXPECT_EQ(leaf->value(), "<");
+    EXPECT_EQ(leaf->first_attribute()->value(), "'");
+    EXPECT_EQ(doc.document(), &doc);
+    // Nodes from a standalone pool take the document that comes to contain them.
+    flxml::memory_pool<> pool;
+    auto orphan = pool.allocate_node(flxml::node_element, "orphan");
+    EXPECT_FALSE(orphan->document());
+    EXPECT_FALSE(orphan->allocator());
+    leaf->append_node(orphan);
+    EXPECT_EQ(orphan->document(), &doc);
+    EXPECT_EQ(orphan->allocator(), &doc);
+}
+
+TEST(Parser, DocumentPointerMoves) {
+    flxml::xml_document<> d1, d2;
+    std::string t1 = "<a><b x='&amp;'><c>&lt;</c></b></a>";
+    std::string t2 = "<z/>";
+    d1.parse<0>(t1);
+    d2.parse<0>(t2);
+    auto b = d1.first_node()->first_node();
+    auto c = b->first_node();
+    // Detached nodes are in no document, but still decode through the one that allocated them.
+    auto fresh = d1.allocate_node(flxml::node_element, "fresh");
+    EXPECT_FALSE(fresh->document());
+    EXPECT_EQ(fresh->allocator(), &d1);
+    d1.first_node()->remove_node(b);
+    EXPECT_FALSE(b->document());
+    EXPECT_FALSE(c->document());
+    EXPECT_FALSE(b->first_attribute()->document());
+    EXPECT_EQ(b->allocator(), &d1);
+    // A subtree moved across documents reports the one now containing it.
+    d2.first_node()->append_node(b);
+    EXPECT_EQ(b->document(), &d2);
+    EXPECT_EQ(c->document(), &d2);
+    EXPECT_EQ(b->first_attribute()->document(), &d2);
+    EXPECT_EQ(b->first_attribute()->allocator(), &d1);
+    EXPECT_EQ(b->first_attribute()->value(), "&");
+    EXPECT_EQ(c->value(), "<");
+    b->append_node(fresh);
+    EXPECT_EQ(fresh->document(), &d2);
+    d2.first_node()->remove_all_nodes();
+    EXPECT_FALSE(fresh->document());
+    d2.first_node()->insert_node(nullptr, b.get());
+    EXPECT_EQ(fresh->document(), &d2);
+    d2.first_node()->remove_first_node();
+    EXPECT_FALSE(c->document());
+}
+
+TEST(Parser, ElementById) {
+    std::string text = "<iq id='one'><query><item id='two&amp;'/><item id='three'/></query><other xml:id='four'/></iq>";
+    flxml::xml_document<> doc;
+    doc.id_attribute("id");
+    doc.parse<0>(text);
+    EXPECT_EQ(doc.element_by_id("one"), doc.first_node());
+    auto two = doc.element_by_id("two&");
+    ASSERT_TRUE(two);
+    EXPECT_EQ(two->name(), "item");
+    EXPECT_EQ(two->next_sibling(), doc.element_by_id("three"));
+    EXPECT_FALSE(doc.element_by_id("four"));
+    EXPECT_FALSE(doc.element_by_id("two&amp;"));
+
+    // Mutations keep the index current.
+    two->first_attribute()->value("five");
+    EXPECT_FALSE(doc.element_by_id("two&"));
+    EXPECT_EQ(doc.element_by_id("five"), two);
+    two->remove_all_attributes();
+    EXPECT_FALSE(doc.element_by_id("five"));
+    auto six = doc.first_node()->append_element("six");
+    six->append_attribute(doc.allocate_attribute("id", "six"));
+    EXPECT_EQ(doc.element_by_id("six"), six);
+    six->first_attribute()->name("not-id");
+    EXPECT_FALSE(doc.element_by_id("six"));
+
+    // Switching the attribute name reindexes the tree.
+    doc.id_attribute("xml:id");
+    EXPECT_FALSE(doc.element_by_id("one"));
+    EXPECT_EQ(doc.element_by_id("four")->name(), "other");
+    doc.parse<0>(text);
+    EXPECT_EQ(doc.element_by_id("four")->name(), "other");
+    doc.id_attribute("");
+    EXPECT_FALSE(doc.element_by_id("four"));
+}
+
+TEST(Parser, ElementByIdSubtrees) {
+    std::string text = "<r><a id='x'><c id='y'/></a><b/></r>";
+    flxml::xml_document<> doc;
+    doc.id_attribute("id");
+    doc.parse<0>(text);
+    auto root = doc.first_node();
+    auto a = root->first_node("a");
+    auto c = a->first_node();
+    // Detaching a subtree removes its IDs, and attaching it again restores them.
+    root->remove_node(a);
+    EXPECT_FALSE(doc.element_by_id("x"));
+    EXPECT_FALSE(doc.element_by_id("y"));
+    a->first_attribute()->value("z");
+    EXPECT_FALSE(doc.element_by_id("z"));
+    auto b = root->last_node();
+    b->append_node(a);
+    EXPECT_EQ(doc.element_by_id("z"), a);
+    EXPECT_EQ(doc.element_by_id("y"), c);
+    root->remove_all_nodes();
+    EXPECT_FALSE(doc.element_by_id("z"));
+    root->prepend_node(b);
+    EXPECT_EQ(doc.element_by_id("y"), c);
+
+    // A subtree moved to another document is indexed there instead.
+    flxml::xml_document<> other;
+    other.id_attribute("id");
+    std::string other_text = "<s/>";
+    other.parse<0>(other_text);
+    root->remove_first_node();
+    other.first_node()->insert_node(nullptr, b.get());
+    EXPECT_FALSE(doc.element_by_id("y"));
+    EXPECT_EQ(other.element_by_id("y"), c);
+    EXPECT_EQ(other.element_by_id("z"), a);
+}
+
+TEST(Parser, ElementByIdDuplicates) {
+    std::string text = "<r><a id='x'/><b id='x'/><c id='x'/></r>";
+    flxml::xml_document<> doc;
+    doc.id_attribute("id");
+    doc.parse<0>(text);
+    auto root = doc.first_node();
+    auto a = root->first_node("a");
+    auto b = root->first_node("b");
+    auto c = root->first_node("c");
+    ASSERT_TRUE(doc.element_by_id("x"));
+    // Whichever element loses the ID, another that still has it is found.
+    a->first_attribute()->value("y");
+    EXPECT_EQ(doc.element_by_id("y"), a);
+    auto found = doc.element_by_id("x");
+    EXPECT_TRUE(found == b || found == c);
+    root->remove_node(found);
+    auto rest = found == b ? c : b;
+    EXPECT_EQ(doc.element_by_id("x"), rest);
+    rest->remove_all_attributes();
+    EXPECT_FALSE(doc.element_by_id("x"));
+    root->append_node(found);
+    EXPECT_EQ(doc.element_by_id("x"), found);
+}
+
+#ifdef FLXML_HAS_MMAP
+TEST(Parser, MappedFile) {
+    auto filename = testing::TempDir() + "flxml-mapped.xml";
+    {
+        std::ofstream out(filename, std::ios::binary);
+        out << "<root><child attr='value'>text</child></root>";
+    }
+    flxml::mapped_file source(filename.c_str());
+    EXPECT_EQ(source.size(), 45);
+    flxml::xml_document<> doc;
+    doc.parse<flxml::parse_full>(source.view());
+    auto child = doc.first_node()->first_node();
+    EXPECT_EQ(child->name(), "child");
+    EXPECT_EQ(child->first_attribute()->value(), "value");
+    EXPECT_EQ(child->value(), "text");
+    // Values refer into the mapping.
+    EXPECT_GE(child->value().data(), source.data());
+    EXPECT_LT(child->value().data(), source.data() + source.size());
+    {
+        std::ofstream out(filename, std::ios::binary | std::ios::trunc);
+    }
+    flxml::mapped_file empty(filename.c_str());
+    EXPECT_EQ(empty.size(), 0);
+    std::remove(filename.c_str());
+    EXPECT_THROW(flxml::mapped_file(filename.c_str()), std::runtime_error);
+}
+#endif
+
+#if defined(FLXML_ZLIB) || defined(FLXML_ZSTD)
+namespace {
+    // Decompresses everything, as parsing to the end would, and joins up the buffers.
+    std::string decompress_all(flxml::decompressed_file<> & source) {
+        auto text = source.text();
+        text += std::numeric_limits<std::ptrdiff_t>::max();
+        std::string out;
+        for (auto segment : source.segments())
+            out += segment;
+        return out;
+    }
+
+    // Random text barely compresses, so its compressed form spans several chunks.
+    std::string random_items(unsigned seed) {
+        std::mt19937 random(seed);
+        std::string text = "<root>";
+        for (int i = 0; i != 4000; ++i) {
+            text += "<item>";
+            for (int j = 0; j != 64; ++j)
+                text += static_cast<char>('a' + random() % 26);
+            text += "</item>";
+        }
+        return text + "</root>";
+    }
+}
+#endif
+
+#ifdef FLXML_ZLIB
+namespace {
+    std::string gzip(std::string const & text) {
+        z_stream zs{};
+        deflateInit2(&zs, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY);
+        std::string out(deflateBound(&zs, text.size()), '\0');
+        zs.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(text.data()));
+        zs.avail_in = text.size();
+        zs.next_out = reinterpret_cast<Bytef *>(out.data());
+        zs.avail_out = out.size();
+        deflate(&zs, Z_FINISH);
+        out.resize(zs.total_out);
+        deflateEnd(&zs);
+        return out;
+    }
+}
+
+TEST(Parser, DecompressedFile) {
+    std::string text = "<root>";
+    for (int i = 0; i != 20000; ++i) {
+        text += "<item n='" + std::to_string(i) + "'>some repetitive text</item>";
+    }
+    text += "</root>";
+    auto compressed = gzip(text);
+    EXPECT_LT(compressed.size(), flxml::decompressed_file<>::chunk_size);
+
+    auto filename = testing::TempDir() + "flxml-compressed.xml.gz";
+    {
+        std::ofstream out(filename, std::ios::binary);
+        out << compressed;
+    }
+    for (bool background : {false, true}) {
+        flxml::decompressed_file source(filename.c_str(), background);
+        flxml::xml_document<> doc;
+        doc.parse<flxml::parse_full>(source.text());
+        int count = 0;
+        for (auto item = doc.first_node()->first_node(); item; item = item->next_sibling()) {
+            EXPECT_EQ(item->first_attribute()->value(), std::to_string(count));
+            EXPECT_EQ(item->value(), "some repetitive text");
+            ++count;
+        }
+        EXPECT_EQ(count, 20000);
+        // The text is held in several buffers, each parsed as it was filled.
+        EXPECT_GT(source.segments().size(), 2u);
+        EXPECT_EQ(decompress_all(source), text);
+    }
+    std::remove(filename.c_str());
+
+    // Concatenated members decompress as one.
+    std::istringstream members(gzip("<a>") + gzip("text") + gzip("</a>"));
+    flxml::decompressed_file joined(members);
+    EXPECT_EQ(decompress_all(joined), "<a>text</a>");
+
+    // Uncompressed input is read as it is.
+    std::istringstream plain(text);
+    flxml::decompressed_file uncompressed(plain);
+    EXPECT_EQ(decompress_all(uncompressed), text);
+
+    // Truncation is found when the parser reaches it.
+    for (bool background : {false, true}) {
+        std::istringstream truncated(compressed.substr(0, compressed.size() / 2));
+        flxml::decompressed_file source(truncated, background);
+        flxml::xml_document<> doc;
+        EXPECT_THROW(doc.parse<0>(source.text()), std::runtime_error);
+    }
+}
+
+TEST(Parser, DecompressedFileChunks) {
+    auto text = random_items(42);
+    auto compressed = gzip(text);
+    EXPECT_GT(compressed.size(), 2 * flxml::decompressed_file<>::chunk_size);
+
+    std::istringstream single(compressed);
+    flxml::decompressed_file source(single);
+    EXPECT_EQ(decompress_all(source), text);
+
+    // Members that straddle chunk boundaries.
+    auto half = text.size() / 2;
+    for (bool background : {false, true}) {
+        std::istringstream members(gzip(text.substr(0, half)) + gzip(text.substr(half)));
+        flxml::decompressed_file joined(members, background);
+        flxml::xml_document<> doc;
+        doc.parse<0>(joined.text());
+        EXPECT_EQ(doc.first_node()->last_node()->value().size(), 64);
+        EXPECT_EQ(decompress_all(joined), text);
+    }
+
+    std::istringstream truncated(compressed.substr(0, compressed.size() - 2 * flxml::decompressed_file<>::chunk_size / 3));
+    flxml::decompressed_file broken(truncated);
+    EXPECT_THROW(decompress_all(broken), std::runtime_error);
+}
+#endif
+
+#ifdef FLXML_ZSTD
+TEST(Parser, DecompressedZstd) {
+    auto text = random_items(7);
+    auto zstd = [](std::string const & input) {
+        std::string out(ZSTD_compressBound(input.size()), '\0');
+        out.resize(ZSTD_compress(out.data(), out.size(), input.data(), input.size(), 3));
+        return out;
+    };
+    auto compressed = zstd(text);
+    EXPECT_GT(compressed.size(), 2 * flxml::decompressed_file<>::chunk_size);
+
+    for (bool background : {false, true}) {
+        std::istringstream single(compressed);
+        flxml::decompressed_file source(single, background);
+        flxml::xml_document<> doc;
+        doc.parse<0>(source.text());
+        EXPECT_EQ(doc.first_node()->last_node()->value().size(), 64);
+        EXPECT_EQ(decompress_all(source), text);
+    }
+
+    // Several frames decompress as one.
+    auto half = text.size() / 2;
+    std::istringstream frames(zstd(text.substr(0, half)) + zstd(text.substr(half)));
+    flxml::decompressed_file joined(frames);
+    EXPECT_EQ(decompress_all(joined), text);
+
+    std::istringstream truncated(compressed.substr(0, compressed.size() - 100));
+    flxml::decompressed_file broken(truncated);
+    EXPECT_THROW(decompress_all(broken), std::runtime_error);
+}
+#endif
+
+namespace {
+    std::string encode(std::u32string const & text, flxml::input_encoding encoding, bool bom) {
+        std::string out;
+        bool big = encoding == flxml::input_encoding::utf16be || encoding == flxml::input_encoding::utf32be;
+        bool wide = encoding == flxml::input_encoding::utf32le || encoding == flxml::input_encoding::utf32be;
+        auto unit = [&](char32_t c) {
+            std::string bytes;
+            for (int i = 0; i != (wide ? 4 : 2); ++i) bytes += static_cast<char>((c >> (8 * i)) & 0xFF);
+            if (big) std::reverse(bytes.begin(), bytes.end());
+            out += bytes;
+        };
+        if (bom) unit(0xFEFF);
+        for (char32_t c : text) {
+            if (!wide && c >= 0x10000) {
+                unit(0xD800 + ((c - 0x10000) >> 10));
+                unit(0xDC00 + ((c - 0x10000) & 0x3FF));
+            } else {
+                unit(c);
+            }
+        }
+        return out;
+    }
+}
+
+TEST(Parser, Utf8Input) {
+    std::u32string text = U"<?xml version='1.0'?><root attr='caf\u00e9'>Long enough to take the fast path: \u00a3 \u20ac \U0001F600 end</root>";
+    std::string expected = "<?xml version='1.0'?><root attr='caf\u00e9'>Long enough to take the fast path: \u00a3 \u20ac \U0001F600 end</root>";
+    for (auto encoding : {flxml::input_encoding::utf16le, flxml::input_encoding::utf16be,
+                          flxml::input_encoding::utf32le, flxml::input_encoding::utf32be}) {
+        for (bool bom : {true, false}) {
+            auto bytes = encode(text, encoding, bom);
+            flxml::utf8_input input(bytes);
+            EXPECT_EQ(input.encoding(), encoding);
+            EXPECT_EQ(input.view(), expected);
+        }
+    }
+    flxml::utf8_input input(encode(text, flxml::input_encoding::utf16be, true));
+    flxml::xml_document<> doc;
+    doc.parse<0>(input.view());
+    EXPECT_EQ(doc.first_node()->first_attribute()->value(), "caf\u00e9");
+
+    // UTF-8 is used where it is.
+    std::string utf8 = "\xEF\xBB\xBF<a/>";
+    flxml::utf8_input plain(utf8);
+    EXPECT_EQ(plain.encoding(), flxml::input_encoding::utf8);
+    EXPECT_EQ(plain.view().data(), utf8.data() + 3);
+
+    std::string latin1 = "<?xml version='1.0' encoding='iso-8859-1'?><a>caf\xE9</a>";
+    EXPECT_EQ(flxml::utf8_input(latin1).view(), "<?xml version='1.0' encoding='iso-8859-1'?><a>caf\u00e9</a>");
+    EXPECT_THROW(flxml::utf8_input("<?xml version='1.0' encoding='EBCDIC'?><a/>"), std::runtime_error);
+    auto unpaired = encode(U"<a>", flxml::input_encoding::utf16le, true) + std::string("\x00\xD8", 2);
+    EXPECT_THROW(flxml::utf8_input{unpaired}, std::runtime_error);
+}
@@ -67,6 +67,61 @@ TEST(Perf, Parse2) {
     std::cout << "Execution time: " << total << " us\n";
 }
 
+#ifdef FLXML_HAS_MMAP
+TEST(Perf, ParseMapped) {
+    using std::chrono::high_resolution_clock;
+    using std::chrono::duration_cast;
+    using std::chrono::microseconds;
+
+    PERF_TEST();
+    flxml::mapped_file source(xml_sample_file);
+
+    std::vector<unsigned long long> timings;
+    for (auto i = 0; i != 1000; ++i) {
+        flxml::xml_document<> doc;
+        auto t1 = high_resolution_clock::now();
+        doc.parse<flxml::parse_full>(source.view());
+        auto t2 = high_resolution_clock::now();
+        auto ms_int = duration_cast<microseconds>(t2 - t1);
+        timings.push_back(ms_int.count());
+    }
+    auto total = 0ULL;
+    for (auto t : timings) {
+        total += t / 1000;
+    }
+    std::cout << "Execution time: " << total << " us\n";
+}
+#endif
+
+TEST(Perf, ParseSegmented) {
+    using std::chrono::high_resolution_clock;
+    using std::chrono::duration_cast;
+    using std::chrono::microseconds;
+
+    PERF_TEST();
+    flxml::file source(xml_sample_file);
+    // As a chain of 4 KiB network buffers.
+    std::string_view text{source.data(), source.size() - 1};
+    std::vector<std::string_view> segments;
+    for (std::size_t i = 0; i < text.size(); i += 4096)
+        segments.push_back(text.substr(i, 4096));
+
+    std::vector<unsigned long long> timings;
+    for (auto i = 0; i != 1000; ++i) {
+        flxml::xml_document<> doc;
+        auto t1 = high_resolution_clock::now();
+        doc.parse<flxml::parse_full>(segments);
+        auto t2 = high_resolution_clock::now();
+        auto ms_int = duration_cast<microseconds>(t2 - t1);
+        timings.push_back(ms_int.count());
+    }
+    auto total = 0ULL;
+    for (auto t : timings) {
+        total += t / 1000;
+    }
+    std::cout << "Execution time: " << total << " us\n";
+}
+
 TEST(Perf, PrintClean) {
     using std::chrono::high_resolution_clock;
     using std::chrono::duration_cast;
@@ -123,3 +178,59 @@ TEST(Perf, PrintDirty) {
     std::cout << "Execution time: " << total << " us\n";
 }
 
+
+TEST(Perf, PrintCleanBuffer) {
+    using std::chrono::high_resolution_clock;
+    using std::chrono::duration_cast;
+    using std::chrono::microseconds;
+
+    PERF_TEST();
+    flxml::file source(xml_sample_file);
+
+    std::vector<unsigned long long> timings;
+    flxml::xml_document<> doc;
+    doc.parse<flxml::parse_full>(source.data());
+    for (auto i = 0; i != 1000; ++i) {
+        flxml::print_buffer<> output;
+        auto t1 = high_resolution_clock::now();
+        flxml::print(output.inserter(), doc);
+        auto t2 = high_resolution_clock::now();
+        auto ms_int = duration_cast<microseconds>(t2 - t1);
+        timings.push_back(ms_int.count());
+    }
+    auto total = 0ULL;
+    for (auto t : timings) {
+        total += t / 1000;
+    }
+    std::cout << "Execution time: " << total << " us\n";
+}
+
+TEST(Perf, PrintDirtyBuffer) {
+    using std::chrono::high_resolution_clock;
+    using std::chrono::duration_cast;
+    using std::chrono::microseconds;
+
+    PERF_TEST();
+    flxml::file source(xml_sample_file);
+
+    std::vector<unsigned long long> timings;
+    flxml::xml_document<> doc_o;
+    doc_o.parse<flxml::parse_full>(source.data());
+    flxml::xml_document<> doc;
+    for (auto & child : flxml::children(doc_o)) {
+        doc.append_node(doc.clone_node(&child, true));
+    }
+    for (auto i = 0; i != 1000; ++i) {
+        flxml::print_buffer<> output;
+        auto t1 = high_resolution_clock::now();
+        flxml::print(output.inserter(), doc);
+        auto t2 = high_resolution_clock::now();
+        auto ms_int = duration_cast<microseconds>(t2 - t1);
+        timings.push_back(ms_int.count());
+    }
+    auto total = 0ULL;
+    for (auto t : timings) {
+        total += t / 1000;
+    }
+    std::cout << "Execution time: " << total << " us\n";
+}
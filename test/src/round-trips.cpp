@@ -5,6 +5,8 @@
 #include <gtest/gtest.h>
 #include <flxml.h>
 #include <flxml/print.h>
+#include <condition_variable>
+#include <mutex>
 
 namespace {
     auto print(flxml::xml_document<> & doc) {
@@ -99,7 +101,8 @@ TEST(RoundTrip, SimpleApos2) {
         doc2.append_node(doc2.clone_node(&child, true));
     }
     EXPECT_EQ(expected, print(doc2));
-    EXPECT_EQ(expected, output);
+    // Unmodified attributes are copied from the source.
+    EXPECT_EQ(input, output);
     // Have we mutated the underlying buffer?
     EXPECT_EQ(input, std::string(buffer.data(), buffer.size() - 1));
 }
@@ -119,20 +122,20 @@ TEST(RoundTrip, SimpleLtBody) {
         doc2.append_node(doc2.clone_node(&child, true));
     }
     EXPECT_EQ(expected, print(doc2));
-    EXPECT_EQ(expected, output);
+    // Unmodified attributes are copied from the source.
+    EXPECT_EQ(input, output);
     // Have we mutated the underlying buffer?
     EXPECT_EQ(input, std::string(buffer.data(), buffer.size() - 1));
 }
 
 TEST(RoundTrip, MutateBody) {
     const char input[] = "<simple arg=\"&apos;\">&lt;</simple>";
-    const char expected[] = "<simple arg=\"'\">&lt;</simple>";
-    const char expected2[] = "<simple arg=\"'\">new value</simple>";
+    const char expected2[] = "<simple arg=\"&apos;\">new value</simple>";
     std::vector<char> buffer{input, input + sizeof(input)};
     flxml::xml_document<> doc;
     doc.parse<flxml::parse_full>(buffer.data());
     auto output = print(doc);
-    EXPECT_EQ(expected, output);
+    EXPECT_EQ(input, output);
     // Have we mutated the underlying buffer?
     EXPECT_EQ(input, std::string(buffer.data(), buffer.size() - 1));
     doc.first_node()->value("new value");
@@ -153,8 +156,8 @@ TEST(RoundTrip, Everything) {
         doc2.append_node(doc2.clone_node(&child, true));
     }
     EXPECT_EQ(expected, print(doc2));
-    // Have we parsed correctly?
-    EXPECT_EQ(expected, output);
+    // Have we parsed correctly? The unmodified document is copied from the source.
+    EXPECT_EQ(input, output);
     // Have we mutated the underlying buffer?
     EXPECT_EQ(input, std::string(buffer.data(), buffer.size() - 1));
 }
@@ -180,3 +183,474 @@ TEST(RoundTrip, EverythingStream) {
     // Have we mutated the underlying buffer?
     EXPECT_EQ(input, std::string(buffer.data(), buffer.size()));
 }
+
+TEST(RoundTrip, PartialModify) {
+    const char input[] = "<message to='a@example.com' from='b@example.com' type='chat'><body>Hi &amp; bye</body> <thread id='t1'/>\n<x a='1'  b='2'/><y/></message>";
+    std::vector<char> buffer{input, input + sizeof(input)};
+    flxml::xml_document<> doc;
+    doc.parse<flxml::parse_full>(buffer.data());
+    auto message = doc.first_node();
+    EXPECT_FALSE(message->source().empty());
+    // Changing one attribute reprints only that attribute; the rest are copied.
+    message->first_attribute("to")->value("c@example.com");
+    EXPECT_TRUE(message->source().empty());
+    EXPECT_EQ(print(doc), "<message to=\"c@example.com\" from='b@example.com' type='chat'><body>Hi &amp; bye</body> <thread id='t1'/>\n<x a='1'  b='2'/><y/></message>");
+    // Changing one child breaks the run of copied siblings around it, but not the whitespace between them.
+    auto thread = message->first_node("thread");
+    thread->first_attribute()->value("t2");
+    EXPECT_EQ(print(doc), "<message to=\"c@example.com\" from='b@example.com' type='chat'><body>Hi &amp; bye</body> <thread id=\"t2\"/>\n<x a='1'  b='2'/><y/></message>");
+    message->first_node("x")->first_attribute()->value("3");
+    EXPECT_EQ(print(doc), "<message to=\"c@example.com\" from='b@example.com' type='chat'><body>Hi &amp; bye</body> <thread id=\"t2\"/>\n<x a=\"3\"  b='2'/><y/></message>");
+    message->remove_node(message->first_node("x"));
+    EXPECT_EQ(print(doc), "<message to=\"c@example.com\" from='b@example.com' type='chat'><body>Hi &amp; bye</body> <thread id=\"t2\"/><y/></message>");
+    // So does removing an attribute from the middle of a run.
+    message->remove_attribute(message->first_attribute("from"));
+    EXPECT_EQ(print(doc), "<message to=\"c@example.com\" type='chat'><body>Hi &amp; bye</body> <thread id=\"t2\"/><y/></message>");
+    EXPECT_EQ(input, std::string(buffer.data(), buffer.size() - 1));
+}
+
+TEST(RoundTrip, PreserveFormatting) {
+    const char input[] = "<config>\n  <server name='a'>\n    <port>80</port>\n  </server>\n  <server name='b'/>\n</config>";
+    std::vector<char> buffer{input, input + sizeof(input)};
+    flxml::xml_document<> doc;
+    doc.parse<flxml::parse_full>(buffer.data());
+    auto pretty = [&doc]() {
+        std::string output;
+        flxml::print(std::back_inserter(output), doc, flxml::print_preserve_formatting);
+        return output;
+    };
+    EXPECT_EQ(pretty(), std::string(input) + "\n");
+    auto config = doc.first_node();
+    config->first_node("server")->first_node("port")->value("8080");
+    EXPECT_EQ(pretty(), "<config>\n  <server name='a'>\n    <port>8080</port>\n  </server>\n  <server name='b'/>\n</config>\n");
+    // New nodes are indented like the sibling before them, and their children by the same unit.
+    auto added = config->append_element("server");
+    added->append_element("port", "443");
+    EXPECT_EQ(pretty(), "<config>\n  <server name='a'>\n    <port>8080</port>\n  </server>\n  <server name='b'/>\n  <server>\n    <port>443</port>\n  </server>\n</config>\n");
+    added->append_element("tls")->append_element("cert", "c");
+    EXPECT_EQ(pretty(), "<config>\n  <server name='a'>\n    <port>8080</port>\n  </server>\n  <server name='b'/>\n  <server>\n    <port>443</port>\n    <tls>\n      <cert>c</cert>\n    </tls>\n  </server>\n</config>\n");
+    // Mixed content gets no new whitespace.
+    const char mixed[] = "<p>Some <b>bold</b> text</p>";
+    flxml::xml_document<> doc2;
+    doc2.parse<flxml::parse_full>(mixed);
+    doc2.first_node()->append_element("i", "more");
+    std::string output;
+    flxml::print(std::back_inserter(output), *doc2.first_node(), flxml::print_preserve_formatting);
+    EXPECT_EQ(output, "<p>Some <b>bold</b> text<i>more</i></p>");
+}
+
+TEST(RoundTrip, PrintBuffer) {
+    const char input[] = "<simple arg='&apos;' other=\"x\"><a>&lt;b&gt;</a><b/>text</simple>";
+    flxml::xml_document<> doc;
+    doc.parse<flxml::parse_full>(input);
+    doc.first_node()->first_node("a")->append_element("c", "\"quoted\"");
+    for (int flags : {0, int(flxml::print_no_indenting), int(flxml::print_preserve_formatting)}) {
+        std::string expected;
+        flxml::print(std::back_inserter(expected), doc, flags);
+        flxml::print_buffer<> buffer(8);
+        flxml::print(buffer.inserter(), doc, flags);
+        EXPECT_EQ(buffer.view(), expected);
+        std::string raw(expected.size(), '\0');
+        auto end = flxml::print(raw.data(), doc, flags);
+        EXPECT_EQ(end, raw.data() + raw.size());
+        EXPECT_EQ(raw, expected);
+    }
+}
+
+TEST(RoundTrip, PrintSize) {
+    const char input[] = "<?xml version='1.0'?><!-- c --><simple arg='&apos;' other=\"x\">\n  <a>&lt;b&gt;</a>\n  <b/><![CDATA[<x>]]>text</simple>";
+    flxml::xml_document<> doc;
+    doc.parse<flxml::parse_full>(input);
+    for (int flags : {0, int(flxml::print_no_indenting), int(flxml::print_preserve_formatting)}) {
+        std::string expected;
+        flxml::print(std::back_inserter(expected), doc, flags);
+        EXPECT_EQ(flxml::print_size(doc, flags), expected.size());
+    }
+    auto simple = doc.first_node("simple");
+    simple->first_attribute("other")->value("a \"quoted\" <value> & 'more'");
+    simple->append_element("c", "a & b < c");
+    simple->first_node("a")->value("'single'");
+    for (int flags : {0, int(flxml::print_no_indenting), int(flxml::print_preserve_formatting)}) {
+        std::string expected;
+        flxml::print(std::back_inserter(expected), doc, flags);
+        auto size = flxml::print_size(doc, flags);
+        EXPECT_EQ(size, expected.size());
+        std::string raw(size, '\0');
+        EXPECT_EQ(flxml::print(raw.data(), doc, flags), raw.data() + size);
+        EXPECT_EQ(raw, expected);
+        std::string element;
+        flxml::print(std::back_inserter(element), *simple, flags);
+        EXPECT_EQ(flxml::print_size(*simple, flags), element.size());
+    }
+}
+
+TEST(RoundTrip, LongEscapes) {
+    // Escapable characters at every offset across several blocks, for the vectorised search.
+    flxml::xml_document<> doc;
+    auto root = doc.append_element("root");
+    std::vector<std::string> values(40, std::string(40, 'x'));
+    for (std::size_t i = 0; i != 40; ++i) {
+        values[i][i] = "<>'\"&"[i % 5];
+        auto child = root->append_element("v", values[i]);
+        child->append_attribute(doc.allocate_attribute("a", values[i]));
+    }
+    std::string output;
+    flxml::print(std::back_inserter(output), *root, flxml::print_no_indenting);
+    std::string expected = "<root>";
+    for (std::size_t i = 0; i != 40; ++i) {
+        std::string prefix(i, 'x'), suffix(39 - i, 'x');
+        char ch = "<>'\"&"[i % 5];
+        std::string text = ch == '<' ? "&lt;" : ch == '>' ? "&gt;" : ch == '\'' ? "&apos;" : ch == '"' ? "&quot;" : "&amp;";
+        std::string attr = ch == '"' ? "'" + prefix + "\"" + suffix + "'" : ch == '\'' ? "\"" + prefix + "'" + suffix + "\"" : "\"" + prefix + text + suffix + "\"";
+        expected += "<v a=" + attr + ">" + prefix + text + suffix + "</v>";
+    }
+    expected += "</root>";
+    EXPECT_EQ(output, expected);
+}
+
+TEST(RoundTrip, PrintGather) {
+    const char input[] = "<message to='someone@example.com'><body>A body long enough to be passed by reference rather than copied.</body><x xmlns=\"urn:x\"/></message>";
+    flxml::xml_document<> doc;
+    doc.parse<flxml::parse_full>(input);
+    auto message = doc.first_node();
+    message->first_attribute("to")->value("someone.else@example.org");
+    message->append_element("thread", "1234");
+    for (int flags : {0, int(flxml::print_no_indenting), int(flxml::print_preserve_formatting)}) {
+        std::string expected;
+        flxml::print(std::back_inserter(expected), doc, flags);
+        flxml::print_gather<> gather;
+        flxml::print(gather.inserter(), doc, flags);
+        std::string joined;
+        for (auto piece : gather.pieces())
+            joined += piece;
+        EXPECT_EQ(joined, expected);
+        EXPECT_EQ(gather.size(), expected.size());
+        // The unmodified body is not copied.
+        bool referenced = false;
+        for (auto piece : gather.pieces())
+            referenced = referenced || (piece.data() >= input && piece.data() < input + sizeof(input));
+        EXPECT_TRUE(referenced);
+#ifdef FLXML_HAS_IOVEC
+        std::size_t total = 0;
+        for (auto const & iov : gather.iovecs())
+            total += iov.iov_len;
+        EXPECT_EQ(total, expected.size());
+#endif
+    }
+}
+
+TEST(RoundTrip, PrintParallel) {
+    std::string input = "<?xml version=\"1.0\"?>\n<archive xmlns=\"urn:archive\">\n";
+    for (int i = 0; i != 100; ++i)
+        input += "  <entry id=\"" + std::to_string(i) + "\"><title>Entry &amp; " + std::to_string(i) + "</title><body>text</body></entry>\n";
+    input += "</archive>\n";
+    flxml::xml_document<> doc;
+    doc.parse<flxml::parse_full>(input);
+    auto archive = doc.first_node("archive");
+    for (auto entry = archive->first_node(); entry; entry = entry->next_sibling()) {
+        if (entry->first_attribute("id")->value().ends_with('3'))
+            entry->first_node("body")->value("changed <text>");
+    }
+    archive->append_element("entry", "new");
+    for (int flags : {0, int(flxml::print_no_indenting), int(flxml::print_preserve_formatting)}) {
+        std::string expected;
+        flxml::print(std::back_inserter(expected), doc, flags);
+        for (unsigned threads : {1u, 2u, 3u, 8u}) {
+            std::string output;
+            flxml::print_parallel(std::back_inserter(output), doc, flags, threads);
+            EXPECT_EQ(output, expected);
+        }
+        std::string element;
+        flxml::print(std::back_inserter(element), *archive, flags);
+        std::string output;
+        flxml::print_parallel(std::back_inserter(output), *archive, flags, 4);
+        EXPECT_EQ(output, element);
+    }
+    // A pool of its own is reused from call to call, and can be printed with from its own threads.
+    {
+        flxml::print_pool pool(2);
+        EXPECT_EQ(pool.size(), 2u);
+        std::string expected;
+        flxml::print(std::back_inserter(expected), doc, flxml::print_no_indenting);
+        for (int i = 0; i != 3; ++i) {
+            std::string output;
+            flxml::print_parallel(std::back_inserter(output), doc, flxml::print_no_indenting, pool);
+            EXPECT_EQ(output, expected);
+        }
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::vector<std::string> nested;
+        for (int i = 0; i != 2; ++i)
+            pool.submit([&]() {
+                std::string output;
+                flxml::print_parallel(std::back_inserter(output), doc, flxml::print_no_indenting, pool);
+                std::lock_guard lock(mutex);
+                nested.push_back(output);
+                cv.notify_all();
+            });
+        std::unique_lock lock(mutex);
+        cv.wait(lock, [&nested]() { return nested.size() == 2; });
+        EXPECT_EQ(nested[0], expected);
+        EXPECT_EQ(nested[1], expected);
+    }
+    // A cached root is printed from its cache, not split.
+    archive->print_cache(true);
+    std::string expected;
+    flxml::print(std::back_inserter(expected), doc, flxml::print_no_indenting);
+    EXPECT_FALSE(archive->printed().empty());
+    for (int i = 0; i != 2; ++i) {
+        std::string output;
+        flxml::print_parallel(std::back_inserter(output), doc, flxml::print_no_indenting, 4);
+        EXPECT_EQ(output, expected);
+    }
+    archive->print_cache(false);
+    archive->print_cache(true);
+    std::string output;
+    flxml::print_parallel(std::back_inserter(output), doc, flxml::print_no_indenting, 4);
+    EXPECT_EQ(output, expected);
+    EXPECT_FALSE(archive->printed().empty());
+}
+
+TEST(RoundTrip, DeepNesting) {
+    // Nesting is limited by FLXML_MAX_DEPTH, not the call stack, when parsing or printing.
+    std::string text;
+    for (int i = 0; i != FLXML_MAX_DEPTH; ++i) text += "<a x='1'>";
+    text += "<b/>deep";
+    for (int i = 0; i != FLXML_MAX_DEPTH; ++i) text += "</a>";
+    flxml::xml_document<> doc;
+    doc.parse<flxml::parse_validate_closing_tags>(text);
+    auto node = doc.first_node();
+    int depth = 0;
+    for (; node->first_node("a"); node = node->first_node("a")) ++depth;
+    EXPECT_EQ(depth, FLXML_MAX_DEPTH - 1);
+    EXPECT_EQ(node->first_node()->name(), "b");
+    EXPECT_EQ(node->value(), "deep");
+    EXPECT_EQ(node->source(), "<a x='1'><b/>deep</a>");
+    EXPECT_EQ(doc.first_node()->source(), text);
+    std::string output;
+    flxml::print(std::back_inserter(output), doc, flxml::print_no_indenting);
+    EXPECT_EQ(output, text);
+
+    // One more level is rejected.
+    std::string deeper = "<a>" + text + "</a>";
+    flxml::xml_document<> doc2;
+    EXPECT_THROW(doc2.parse<0>(deeper), flxml::parse_error);
+
+    // Modified trees are printed without recursion too.
+    node->append_element("c", "new");
+    output.clear();
+    flxml::print(std::back_inserter(output), doc, flxml::print_no_indenting);
+    EXPECT_EQ(output.size(), text.size() + 10);
+    output.clear();
+    flxml::print(std::back_inserter(output), doc);
+    EXPECT_NE(output.find("\t<c>new</c>\n"), std::string::npos);
+    EXPECT_TRUE(output.ends_with("\n\t</a>\n</a>\n\n"));
+}
+
+TEST(RoundTrip, Canonical) {
+    // From the Canonical XML 1.0 specification, section 3.3, less the DTD.
+    const char input[] = "<?xml version='1.0'?>\n<!-- Comment -->\n<doc>\n"
+                         "   <e1   />\n"
+                         "   <e2   ></e2>\n"
+                         "   <e3   name = \"elem3\"   id=\"elem3\"   />\n"
+                         "   <e4   name=\"elem4\"   id=\"elem4\"   ></e4>\n"
+                         "   <e5 a:attr=\"out\" b:attr=\"sorted\" attr2=\"all\" attr=\"I'm\"\n"
+                         "      xmlns:b=\"http://www.ietf.org\"\n"
+                         "      xmlns:a=\"http://www.w3.org\"\n"
+                         "      xmlns=\"http://example.org\"/>\n"
+                         "   <e6 xmlns=\"\" xmlns:a=\"http://www.w3.org\">\n"
+                         "      <e7 xmlns=\"http://www.ietf.org\">\n"
+                         "         <e8 xmlns=\"\" xmlns:a=\"http://www.w3.org\">\n"
+                         "            <e9 xmlns=\"\" xmlns:a=\"http://www.ietf.org\"/>\n"
+                         "         </e8>\n"
+                         "      </e7>\n"
+                         "   </e6>\n"
+                         "</doc>\n<?pi data?>";
+    flxml::xml_document<> doc;
+    doc.parse<flxml::parse_full>(input);
+    std::string output;
+    flxml::print(std::back_inserter(output), doc, flxml::print_c14n);
+    const std::string body = "<doc>\n"
+                             "   <e1></e1>\n"
+                             "   <e2></e2>\n"
+                             "   <e3 id=\"elem3\" name=\"elem3\"></e3>\n"
+                             "   <e4 id=\"elem4\" name=\"elem4\"></e4>\n"
+                             "   <e5 xmlns=\"http://example.org\" xmlns:a=\"http://www.w3.org\" xmlns:b=\"http://www.ietf.org\" attr=\"I'm\" attr2=\"all\" b:attr=\"sorted\" a:attr=\"out\"></e5>\n"
+                             "   <e6 xmlns:a=\"http://www.w3.org\">\n"
+                             "      <e7 xmlns=\"http://www.ietf.org\">\n"
+                             "         <e8 xmlns=\"\">\n"
+                             "            <e9 xmlns:a=\"http://www.ietf.org\"></e9>\n"
+                             "         </e8>\n"
+                             "      </e7>\n"
+                             "   </e6>\n"
+                             "</doc>";
+    EXPECT_EQ(output, body + "\n<?pi data?>");
+    EXPECT_EQ(flxml::print_size(doc, flxml::print_c14n), output.size());
+    output.clear();
+    flxml::print(std::back_inserter(output), doc, flxml::print_c14n | flxml::print_c14n_comments);
+    EXPECT_EQ(output, "<!-- Comment -->\n" + body + "\n<?pi data?>");
+}
+
+TEST(RoundTrip, CanonicalExclusive) {
+    // From the Exclusive XML Canonicalization 1.0 specification, section 2.2.
+    const char input[] = "<n0:local xmlns:n0=\"foo:bar\" xmlns:n3=\"ftp://example.org\"><n1:elem2 xmlns:n1=\"http://example.net\" xml:lang=\"en\"><n3:stuff xmlns:n3=\"ftp://example.org\"/></n1:elem2></n0:local>";
+    flxml::xml_document<> doc;
+    doc.parse<flxml::parse_full>(input);
+    auto elem2 = doc.first_node()->first_node();
+    std::string output;
+    flxml::print(std::back_inserter(output), *elem2, flxml::print_c14n);
+    EXPECT_EQ(output, "<n1:elem2 xmlns:n0=\"foo:bar\" xmlns:n1=\"http://example.net\" xmlns:n3=\"ftp://example.org\" xml:lang=\"en\"><n3:stuff></n3:stuff></n1:elem2>");
+    output.clear();
+    flxml::print(std::back_inserter(output), *elem2, flxml::print_c14n_exclusive);
+    EXPECT_EQ(output, "<n1:elem2 xmlns:n1=\"http://example.net\" xml:lang=\"en\"><n3:stuff xmlns:n3=\"ftp://example.org\"></n3:stuff></n1:elem2>");
+
+    // Escaping differs from the printer's, and modified trees canonicalize the same way.
+    flxml::xml_document<> doc2;
+    doc2.parse<0>("<a b='x&#9;y&quot;&lt;&gt;'>1 &lt; 2 &gt; &amp; \"q\" &#13;<![CDATA[<c>]]></a>");
+    output.clear();
+    flxml::print(std::back_inserter(output), doc2, flxml::print_c14n);
+    EXPECT_EQ(output, "<a b=\"x&#x9;y&quot;&lt;>\">1 &lt; 2 &gt; &amp; \"q\" &#xD;&lt;c&gt;</a>");
+    doc2.first_node()->append_element({"urn:x", "d"}, "e");
+    output.clear();
+    flxml::print(std::back_inserter(output), doc2, flxml::print_c14n_exclusive);
+    EXPECT_EQ(output, "<a b=\"x&#x9;y&quot;&lt;>\">1 &lt; 2 &gt; &amp; \"q\" &#xD;&lt;c&gt;<d xmlns=\"urn:x\">e</d></a>");
+}
+
+TEST(RoundTrip, StartTagCopy) {
+    const char input[] = "<a  x='1'\n   y=\"2\" ><b/></a>";
+    flxml::xml_document<> doc;
+    doc.parse<flxml::parse_full>(input);
+    auto a = doc.first_node();
+    EXPECT_EQ(a->start_tag(), "<a  x='1'\n   y=\"2\"");
+    EXPECT_EQ(a->first_node()->start_tag(), "<b");
+    // Changing the children keeps the start tag as it was.
+    a->append_element("c");
+    EXPECT_EQ(a->start_tag(), "<a  x='1'\n   y=\"2\"");
+    std::string output;
+    flxml::print(std::back_inserter(output), doc, flxml::print_no_indenting);
+    EXPECT_EQ(output, "<a  x='1'\n   y=\"2\"><b/><c/></a>");
+    // Changing an attribute does not, but each attribute keeps the whitespace before it.
+    a->first_attribute("y")->value("3");
+    EXPECT_EQ(a->start_tag(), "");
+    output.clear();
+    flxml::print(std::back_inserter(output), doc, flxml::print_no_indenting);
+    EXPECT_EQ(output, "<a  x='1'\n   y=\"3\"><b/><c/></a>");
+    // New attributes have a single space.
+    a->append_attribute(doc.allocate_attribute("z", "4"));
+    output.clear();
+    flxml::print(std::back_inserter(output), doc, flxml::print_no_indenting);
+    EXPECT_EQ(output, "<a  x='1'\n   y=\"3\" z=\"4\"><b/><c/></a>");
+}
+
+TEST(RoundTrip, PrintCache) {
+    flxml::xml_document<> doc;
+    auto root = doc.append_element("root");
+    auto roster = root->append_element("roster");
+    roster->print_cache(true);
+    auto item = roster->append_element("item");
+    item->append_attribute(doc.allocate_attribute("jid", "a@example.com"));
+    item->append_element("group", "Friends & Family");
+    auto print = [&doc]() {
+        std::string output;
+        flxml::print(std::back_inserter(output), doc, flxml::print_no_indenting);
+        return output;
+    };
+    EXPECT_EQ(roster->printed(), "");
+    auto first = print();
+    EXPECT_EQ(first, "<root><roster><item jid=\"a@example.com\"><group>Friends &amp; Family</group></item></roster></root>");
+    EXPECT_EQ(roster->printed(), "<item jid=\"a@example.com\"><group>Friends &amp; Family</group></item>");
+    auto cached = roster->printed().data();
+    // Changes outside the element keep the cache; printing reuses it.
+    root->append_element("presence");
+    EXPECT_EQ(print(), "<root><roster><item jid=\"a@example.com\"><group>Friends &amp; Family</group></item></roster><presence/></root>");
+    EXPECT_EQ(roster->printed().data(), cached);
+    // Indented printing neither uses nor fills it.
+    std::string indented;
+    flxml::print(std::back_inserter(indented), doc);
+    EXPECT_EQ(indented, "<root>\n\t<roster>\n\t\t<item jid=\"a@example.com\">\n\t\t\t<group>Friends &amp; Family</group>\n\t\t</item>\n\t</roster>\n\t<presence/>\n</root>\n\n");
+    EXPECT_EQ(roster->printed().data(), cached);
+    // Changes to descendants discard it.
+    item->first_attribute()->value("b@example.com");
+    EXPECT_EQ(roster->printed(), "");
+    EXPECT_EQ(print(), "<root><roster><item jid=\"b@example.com\"><group>Friends &amp; Family</group></item></roster><presence/></root>");
+    EXPECT_EQ(roster->printed(), "<item jid=\"b@example.com\"><group>Friends &amp; Family</group></item>");
+    // The refill fits, so it reuses the memory.
+    EXPECT_EQ(roster->printed().data(), cached);
+    {
+        flxml::mutation_batch batch(doc);
+        item->first_node()->value("Work");
+    }
+    EXPECT_EQ(roster->printed(), "");
+    // Measuring leaves the cache empty.
+    EXPECT_EQ(flxml::print_size(doc, flxml::print_no_indenting), 93u);
+    EXPECT_EQ(roster->printed(), "");
+    EXPECT_EQ(print(), "<root><roster><item jid=\"b@example.com\"><group>Work</group></item></roster><presence/></root>");
+    EXPECT_EQ(flxml::print_size(doc, flxml::print_no_indenting), print().size());
+    roster->print_cache(false);
+    EXPECT_EQ(roster->printed(), "");
+}
+
+TEST(RoundTrip, Segmented) {
+    // Nodes straddling a split are printed from the tree, so this is written as the printer would write it.
+    std::string input = "<?xml version=\"1.0\"?><pfx:root xmlns:pfx=\"urn:test\"><!-- note --><item id=\"one\" group=\"a &amp; b\">text &lt; here</item>"
+                        "<pfx:empty/><![CDATA[raw <data>]]><?pi value?></pfx:root>";
+    // Split the text at every offset, with an empty segment there too.
+    for (std::size_t i = 0; i <= input.size(); ++i) {
+        std::string_view text = input;
+        std::vector<std::string_view> segments{text.substr(0, i), {}, text.substr(i)};
+        flxml::xml_document<> doc;
+        doc.parse<flxml::parse_full>(segments);
+        EXPECT_EQ(print(doc), input) << "split at " << i;
+        auto item = doc.last_node()->first_node()->next_sibling();
+        EXPECT_EQ(item->name(), "item");
+        EXPECT_EQ(item->first_attribute("group")->value(), "a & b");
+        EXPECT_EQ(item->value(), "text < here");
+        EXPECT_EQ(doc.last_node()->prefix(), "pfx");
+        EXPECT_EQ(doc.last_node()->name(), "root");
+        // Names are viewed in place unless the split falls within them.
+        auto id = item->first_attribute("id");
+        auto offset = static_cast<std::size_t>(input.find("id=\"one\""));
+        if (i <= offset || i >= offset + 2)
+            EXPECT_TRUE(id->name().data() == segments[0].data() + offset || id->name().data() == segments[2].data() + offset - i);
+        else
+            EXPECT_FALSE(id->name().data() >= input.data() && id->name().data() < input.data() + input.size());
+    }
+    // Many small segments, such as network buffers.
+    std::vector<std::string_view> chunks;
+    for (std::size_t i = 0; i < input.size(); i += 3)
+        chunks.push_back(std::string_view(input).substr(i, 3));
+    flxml::xml_document<> doc;
+    doc.parse<flxml::parse_full>(chunks);
+    EXPECT_EQ(print(doc), input);
+    std::vector<std::string_view> truncated{std::string_view(input).substr(0, 40), std::string_view(input).substr(40, 20)};
+    EXPECT_THROW(doc.parse<0>(truncated), flxml::parse_error);
+}
+
+TEST(RoundTrip, SegmentedContents) {
+    std::string input = "<r><a x='1'>hello world</a></r>";
+    std::string_view text = input;
+    for (std::size_t i = 0; i <= input.size(); ++i) {
+        std::vector<std::string_view> segments{text.substr(0, i), text.substr(i)};
+        flxml::xml_document<> doc;
+        doc.parse<0>(segments);
+        auto a = doc.first_node()->first_node();
+        EXPECT_EQ(a->contents(), "hello world") << "split at " << i;
+        EXPECT_EQ(doc.first_node()->contents(), "<a x='1'>hello world</a>") << "split at " << i;
+        EXPECT_EQ(a->start_tag(), "<a x='1'") << "split at " << i;
+        EXPECT_TRUE(a->clean());
+    }
+}
+
+TEST(RoundTrip, SegmentedRepeats) {
+    // A reused buffer can appear as several segments; each is a different place in the input.
+    std::string_view item = "<a>x</a>";
+    std::vector<std::string_view> segments{"<r>", item, item, "</r>"};
+    flxml::segmented_ptr<char> start(segments);
+    EXPECT_NE(start + 3, start + 11);
+    EXPECT_EQ((start + 11) - (start + 3), 8);
+    EXPECT_EQ(start + 11, start + 3 + 8);
+    EXPECT_EQ(flxml::segmented_ptr<char>(std::span<const std::string_view>()), flxml::segmented_ptr<char>());
+    flxml::xml_document<> doc;
+    doc.parse<flxml::parse_full>(segments);
+    EXPECT_EQ(print(doc), "<r><a>x</a><a>x</a></r>");
+}
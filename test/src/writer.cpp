@@ -0,0 +1,74 @@
+//
+// Streaming writer tests
+//
+
+#include <gtest/gtest.h>
+
+#include <flxml.h>
+#include <flxml/print.h>
+#include <flxml/writer.h>
+
+TEST(Writer, Simple) {
+    std::string output;
+    flxml::xml_writer writer(std::back_inserter(output));
+    writer.start_element("fish")
+        .attribute("id", "haddock")
+        .attribute("says", "\"hello\"")
+        .text("cakes & <chips>")
+        .start_element("empty").end_element()
+        .end_element();
+    EXPECT_EQ(writer.depth(), 0);
+    EXPECT_EQ(output, "<fish id=\"haddock\" says='\"hello\"'>cakes &amp; &lt;chips&gt;<empty/></fish>");
+}
+
+TEST(Writer, MatchesDocument) {
+    // The same stanza built as a tree and printed.
+    flxml::xml_document<> doc;
+    auto message = doc.append_element({"jabber:client", "message"});
+    message->append_attribute(doc.allocate_attribute("to", "romeo@example.net"));
+    message->append_element({"jabber:client", "body"}, "Wherefore art thou?");
+    auto x = message->append_element({"urn:example:x", "x"});
+    x->append_element({"urn:example:x", "item"}, "a < b");
+    message->append_element({"jabber:client", "thread"}, "1234");
+    std::string expected;
+    flxml::print(std::back_inserter(expected), doc, flxml::print_no_indenting);
+
+    flxml::print_buffer<> buffer;
+    flxml::xml_writer writer(buffer.inserter());
+    writer.start_element({"jabber:client", "message"})
+        .attribute("to", "romeo@example.net")
+        .element({"jabber:client", "body"}, "Wherefore art thou?")
+        .start_element({"urn:example:x", "x"})
+            .element({"urn:example:x", "item"}, "a < b")
+        .end_element()
+        .element({"jabber:client", "thread"}, "1234")
+        .end_element();
+    EXPECT_EQ(buffer.view(), expected);
+}
+
+TEST(Writer, Prefixes) {
+    std::string output;
+    flxml::xml_writer writer(std::back_inserter(output));
+    writer.start_element("stream:stream")
+        .attribute("xmlns:stream", "http://etherx.jabber.org/streams")
+        .attribute("xmlns", "jabber:client")
+        .start_element({"http://etherx.jabber.org/streams", "features"})
+            .element({"jabber:client", "ping"}, "")
+        .end_element()
+        .end_element();
+    EXPECT_EQ(output, "<stream:stream xmlns:stream=\"http://etherx.jabber.org/streams\" xmlns=\"jabber:client\"><stream:features><ping xmlns=\"jabber:client\"/></stream:features></stream:stream>");
+    // The same prefixed stream parses back into the right namespaces.
+    flxml::xml_document<> doc;
+    doc.parse<0>(output);
+    EXPECT_EQ(doc.first_node()->first_node()->xmlns(), "http://etherx.jabber.org/streams");
+    EXPECT_EQ(doc.first_node()->first_node()->first_node()->xmlns(), "jabber:client");
+}
+
+TEST(Writer, Misuse) {
+    std::string output;
+    flxml::xml_writer writer(std::back_inserter(output));
+    EXPECT_THROW(writer.end_element(), flxml::writer_error);
+    EXPECT_THROW(writer.text("x"), flxml::writer_error);
+    writer.start_element("a").text("x");
+    EXPECT_THROW(writer.attribute("b", "c"), flxml::writer_error);
+}